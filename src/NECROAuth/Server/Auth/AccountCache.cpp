@@ -0,0 +1,164 @@
+#include "AccountCache.h"
+
+#include "ConsoleLogger.h"
+#include "FileLogger.h"
+
+#include <functional>
+
+namespace NECRO
+{
+namespace Auth
+{
+	AccountCache::AccountCache(size_t capacity, int ttlSec, int negativeTTLSec) :
+		m_shardCapacity(capacity / SHARDS_COUNT > 0 ? capacity / SHARDS_COUNT : 1),
+		m_ttl(ttlSec),
+		m_negativeTTL(negativeTTLSec)
+	{
+
+	}
+
+	AccountCache::Shard& AccountCache::GetShard(const std::string& username)
+	{
+		return m_shards[std::hash<std::string>{}(username) % SHARDS_COUNT];
+	}
+
+	AccountCache::LookupResult AccountCache::Lookup(const std::string& username, uint32_t& outAccountID)
+	{
+		Shard& shard = GetShard(username);
+		std::lock_guard<std::mutex> lock(shard.mutex);
+
+		auto it = shard.index.find(username);
+		if (it == shard.index.end())
+		{
+			m_misses.fetch_add(1, std::memory_order_relaxed);
+			return LookupResult::MISS;
+		}
+
+		auto entry = it->second;
+
+		if (entry->expiresAt <= std::chrono::steady_clock::now())
+		{
+			shard.lru.erase(entry);
+			shard.index.erase(it);
+
+			m_expirations.fetch_add(1, std::memory_order_relaxed);
+			m_misses.fetch_add(1, std::memory_order_relaxed);
+			return LookupResult::MISS;
+		}
+
+		// Move to the front, it's the most recently used now
+		shard.lru.splice(shard.lru.begin(), shard.lru, entry);
+
+		if (!entry->exists)
+		{
+			m_negativeHits.fetch_add(1, std::memory_order_relaxed);
+			return LookupResult::NOT_FOUND;
+		}
+
+		m_hits.fetch_add(1, std::memory_order_relaxed);
+		outAccountID = entry->accountID;
+		return LookupResult::FOUND;
+	}
+
+	void AccountCache::Insert(const std::string& username, uint32_t accountID)
+	{
+		Put(username, accountID, true);
+	}
+
+	void AccountCache::InsertNotFound(const std::string& username)
+	{
+		Put(username, 0, false);
+	}
+
+	void AccountCache::Put(const std::string& username, uint32_t accountID, bool exists)
+	{
+		auto expiresAt = std::chrono::steady_clock::now() + (exists ? m_ttl : m_negativeTTL);
+
+		Shard& shard = GetShard(username);
+		std::lock_guard<std::mutex> lock(shard.mutex);
+
+		auto it = shard.index.find(username);
+		if (it != shard.index.end())
+		{
+			// Refresh the existing entry
+			it->second->accountID = accountID;
+			it->second->exists = exists;
+			it->second->expiresAt = expiresAt;
+			shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+			return;
+		}
+
+		// Make room by dropping the least recently used entry
+		if (shard.index.size() >= m_shardCapacity)
+		{
+			shard.index.erase(shard.lru.back().username);
+			shard.lru.pop_back();
+
+			m_evictions.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		shard.lru.push_front({ username, accountID, exists, expiresAt });
+		shard.index[username] = shard.lru.begin();
+	}
+
+	void AccountCache::Invalidate(const std::string& username)
+	{
+		Shard& shard = GetShard(username);
+		std::lock_guard<std::mutex> lock(shard.mutex);
+
+		auto it = shard.index.find(username);
+		if (it == shard.index.end())
+			return;
+
+		shard.lru.erase(it->second);
+		shard.index.erase(it);
+
+		m_invalidations.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void AccountCache::Clear()
+	{
+		for (Shard& shard : m_shards)
+		{
+			std::lock_guard<std::mutex> lock(shard.mutex);
+
+			m_invalidations.fetch_add(shard.index.size(), std::memory_order_relaxed);
+
+			shard.index.clear();
+			shard.lru.clear();
+		}
+	}
+
+	AccountCache::Stats AccountCache::GetStats()
+	{
+		Stats s;
+		s.hits = m_hits.load(std::memory_order_relaxed);
+		s.negativeHits = m_negativeHits.load(std::memory_order_relaxed);
+		s.misses = m_misses.load(std::memory_order_relaxed);
+		s.evictions = m_evictions.load(std::memory_order_relaxed);
+		s.expirations = m_expirations.load(std::memory_order_relaxed);
+		s.invalidations = m_invalidations.load(std::memory_order_relaxed);
+		s.size = 0;
+
+		for (Shard& shard : m_shards)
+		{
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			s.size += shard.index.size();
+		}
+
+		return s;
+	}
+
+	void AccountCache::LogStats()
+	{
+		Stats s = GetStats();
+
+		uint64_t lookups = s.hits + s.negativeHits + s.misses;
+		double hitRate = lookups > 0 ? (100.0 * (s.hits + s.negativeHits)) / lookups : 0.0;
+
+		LOG_INFO("AccountCache: {} entries (capacity {}) | hits {} | negative hits {} | misses {} | hit rate {:.1f}% | evictions {} | expirations {} | invalidations {}",
+					s.size, m_shardCapacity * SHARDS_COUNT, s.hits, s.negativeHits, s.misses, hitRate, s.evictions, s.expirations, s.invalidations);
+	}
+
+}
+}
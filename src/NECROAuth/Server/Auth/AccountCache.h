@@ -0,0 +1,101 @@
+#ifndef NECRO_ACCOUNT_CACHE_H
+#define NECRO_ACCOUNT_CACHE_H
+
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <array>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace NECRO
+{
+namespace Auth
+{
+	//-----------------------------------------------------------------------------------------------------
+	// username -> accountID cache shared by all the reactors, it spares the SEL_ACCOUNT_ID_BY_NAME round trip
+	// when the same accounts log in again and again (ex. reconnect storms after a world server restart).
+	// Unknown usernames are cached as well (negative entries) with a shorter TTL.
+	// The cache is split in shards, each with its own lock and LRU list, bounded to capacity / SHARDS_COUNT entries
+	//-----------------------------------------------------------------------------------------------------
+	class AccountCache
+	{
+	public:
+		static constexpr size_t	SHARDS_COUNT = 16;
+		static constexpr size_t	DEFAULT_CAPACITY = 65536;
+		static constexpr int	DEFAULT_TTL_SEC = 300;
+		static constexpr int	DEFAULT_NEGATIVE_TTL_SEC = 30;
+
+		enum class LookupResult
+		{
+			MISS = 0,	// not in cache (or expired), ask the DB
+			FOUND,		// accountID is valid
+			NOT_FOUND	// the DB said recently that this account doesn't exist
+		};
+
+		struct Stats
+		{
+			uint64_t hits;
+			uint64_t negativeHits;
+			uint64_t misses;
+			uint64_t evictions;		// removed to make room
+			uint64_t expirations;	// removed because the TTL passed
+			uint64_t invalidations;	// removed by Invalidate()
+			size_t	 size;
+		};
+
+	private:
+		struct Entry
+		{
+			std::string								username;
+			uint32_t								accountID;
+			bool									exists;
+			std::chrono::steady_clock::time_point	expiresAt;
+		};
+
+		struct Shard
+		{
+			std::mutex														mutex;
+			std::list<Entry>												lru;	// most recently used at the front
+			std::unordered_map<std::string, std::list<Entry>::iterator>		index;
+		};
+
+		std::array<Shard, SHARDS_COUNT>	m_shards;
+		size_t							m_shardCapacity;
+		std::chrono::seconds			m_ttl;
+		std::chrono::seconds			m_negativeTTL;
+
+		std::atomic<uint64_t> m_hits{ 0 };
+		std::atomic<uint64_t> m_negativeHits{ 0 };
+		std::atomic<uint64_t> m_misses{ 0 };
+		std::atomic<uint64_t> m_evictions{ 0 };
+		std::atomic<uint64_t> m_expirations{ 0 };
+		std::atomic<uint64_t> m_invalidations{ 0 };
+
+		Shard& GetShard(const std::string& username);
+
+	public:
+		AccountCache(size_t capacity = DEFAULT_CAPACITY, int ttlSec = DEFAULT_TTL_SEC, int negativeTTLSec = DEFAULT_NEGATIVE_TTL_SEC);
+
+		LookupResult	Lookup(const std::string& username, uint32_t& outAccountID);
+
+		void			Insert(const std::string& username, uint32_t accountID);
+		void			InsertNotFound(const std::string& username);
+
+		// Invalidation hooks, to call when an account is created, renamed or deleted
+		void			Invalidate(const std::string& username);
+		void			Clear();
+
+		Stats			GetStats();
+		void			LogStats();
+
+	private:
+		void			Put(const std::string& username, uint32_t accountID, bool exists);
+	};
+
+}
+}
+
+#endif
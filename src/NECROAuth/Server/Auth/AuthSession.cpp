@@ -3,6 +3,7 @@
 #include "AuthCodes.h"
 #include "TCPSocketManager.h"
 #include "DBRequest.h"
+#include "AccountCache.h"
 
 #include <random>
 #include <sstream>
@@ -16,8 +17,8 @@ namespace Auth
     {
         std::unordered_map<uint8_t, AuthHandler> handlers;
 
-        handlers[static_cast<int>(PacketIDs::LOGIN_GATHER_INFO)]    = { SocketStatus::GATHER_INFO, S_PACKET_AUTH_LOGIN_GATHER_INFO_INITIAL_SIZE, &HandleAuthLoginGatherInfoPacket };
-        handlers[static_cast<int>(PacketIDs::LOGIN_ATTEMPT)]        = { SocketStatus::LOGIN_ATTEMPT, S_PACKET_AUTH_LOGIN_PROOF_INITIAL_SIZE, &HandleAuthLoginProofPacket };
+        handlers[static_cast<int>(PacketIDs::LOGIN_GATHER_INFO)]    = { SocketStatus::GATHER_INFO, S_PACKET_AUTH_LOGIN_GATHER_INFO_INITIAL_SIZE, &AuthSession::HandleAuthLoginGatherInfoPacket };
+        handlers[static_cast<int>(PacketIDs::LOGIN_ATTEMPT)]        = { SocketStatus::LOGIN_ATTEMPT, S_PACKET_AUTH_LOGIN_PROOF_INITIAL_SIZE, &AuthSession::HandleAuthLoginProofPacket };
 
         return handlers;
     }
@@ -28,7 +29,7 @@ namespace Auth
     {
         LOG_DEBUG("AuthSession ReadCallback");
 
-        NetworkMessage& packet = m_inBuffer;
+        RecvBuffer& packet = m_inBuffer;
 
         while (packet.GetActiveSize())
         {
@@ -115,30 +116,66 @@ namespace Auth
         LOG_DEBUG("Handling AuthLoginInfo for user: {}", login);
 
         // Here we would perform checks such as account exists, banned, suspended, IP locked, region locked, etc.
-        auto& dbWorker = g_server.GetDBWorker();
+        // Accounts that were looked up recently (or are known to not exist) are answered without going to the DB
+        uint32_t cachedAccountID = 0;
+        AccountCache::LookupResult cached = g_server.GetAccountCache().Lookup(login, cachedAccountID);
+
+        if (cached != AccountCache::LookupResult::MISS)
+            return SendAuthLoginGatherInfoReply(cached == AccountCache::LookupResult::FOUND, cachedAccountID);
+
+        auto& dbPool = g_server.GetDBWorkerPool();
         {
-            DBRequest req(false, dbWorker.Prepare(static_cast<int>(LoginDatabaseStatements::SEL_ACCOUNT_ID_BY_NAME)));
-            req.m_sqlStmt.bind(login);
-            req.m_callback = [this](mysqlx::SqlResult& res) {return this->DBCallback_AuthLoginGatherInfoPacket(res); };
-            req.m_noticeFunc = []() {return g_server.GetSocketManager().WakeUp(); };
-            dbWorker.Enqueue(std::move(req));
+            TCPSocketManager* owner = m_owner;
+            SlotHandle handle = m_handle;
+
+            DBRequest req(false, static_cast<int>(LoginDatabaseStatements::SEL_ACCOUNT_ID_BY_NAME));
+            req.Bind(login);
+            req.m_callback = [owner, handle](mysqlx::SqlResult* res) { return owner->DispatchDBCallback(handle, [&res](AuthSession* s) { return s->DBCallback_AuthLoginGatherInfoPacket(res); }); };
+            req.m_respQueue = &owner->GetDBResponseQueue();
+            req.m_noticeFunc = [owner]() {return owner->WakeUp(); };
+            if (!dbPool.Enqueue(std::move(req), login))
+            {
+                LOG_WARNING("DB workers are overloaded, dropping the login of {}.", login);
+                return false;
+            }
         }
 
         return true;
     }
 
-    bool AuthSession::DBCallback_AuthLoginGatherInfoPacket(mysqlx::SqlResult& result)
+    bool AuthSession::DBCallback_AuthLoginGatherInfoPacket(mysqlx::SqlResult* result)
     {
         LOG_CRITICAL("Handling callback for user {}!!", m_data.username);
 
-        // Reply to the client
-        Packet packet;
-
-        packet << uint8_t(PacketIDs::LOGIN_GATHER_INFO);
+        // The lookup failed on the DB worker, there's no answer to give: close now instead of letting the client wait for the timeout
+        if (!result)
+        {
+            LOG_WARNING("Could not look up the account of {}, closing the connection.", m_data.username);
+            return false;
+        }
 
-        mysqlx::Row row = result.fetchOne();
+        mysqlx::Row row = result->fetchOne();
 
         if (!row)
+        {
+            g_server.GetAccountCache().InsertNotFound(m_data.username);
+            return SendAuthLoginGatherInfoReply(false, 0);
+        }
+
+        uint32_t accountID = row[0];
+        g_server.GetAccountCache().Insert(m_data.username, accountID);
+
+        return SendAuthLoginGatherInfoReply(true, accountID);
+    }
+
+    bool AuthSession::SendAuthLoginGatherInfoReply(bool accountExists, uint32_t accountID)
+    {
+        // Reply to the client, sized to the reply so it comes from the smallest class of the BufferPool instead of a 4 KiB block
+        Packet packet(sizeof(CPacketAuthLoginGatherInfo));
+
+        packet << uint8_t(PacketIDs::LOGIN_GATHER_INFO);
+
+        if (!accountExists)
         {
             LOG_INFO("User tried to login with an username that doesn't exist.");
             packet << uint8_t(AuthResults::FAILED_UNKNOWN_ACCOUNT);
@@ -150,9 +187,9 @@ namespace Auth
             {
                 packet << uint8_t(AuthResults::SUCCESS);
 
-                m_data.accountID = row[0];
+                m_data.accountID = accountID;
                 LOG_INFO("Account {} has DB AccountID: {}.", m_data.username, m_data.accountID);
-                m_status = SocketStatus::LOGIN_ATTEMPT;
+                m_owner->EnterStage(this, SocketStatus::LOGIN_ATTEMPT);
 
                 // Done, will wait for client's proof packet
             }
@@ -163,10 +200,10 @@ namespace Auth
             }
         }
 
-        NetworkMessage m(packet);
+        NetworkMessage m(std::move(packet));
 
         /* Encryption example
-        int res = m.AESEncrypt(data.sessionKey.data(), data.iv, nullptr, 0);
+        int res = m.AESEncrypt(m_data.cipher, m_data.iv, nullptr, 0);
         if (res < 0)
             return false;
         */
@@ -184,35 +221,78 @@ namespace Auth
 
         LOG_OK("Handling AuthLoginProof for user {}", m_data.username);
 
-        // Reply to the client
-        Packet packet;
+        // Only one proof can be in flight per session
+        if (m_proofPending)
+        {
+            LOG_WARNING("User {} sent a proof while the previous one was still being verified.", this->GetRemoteAddressAndPort());
+            return false;
+        }
 
-        packet << uint8_t(PacketIDs::LOGIN_ATTEMPT);
+        // The packet lives in m_inBuffer, keep what the callback needs
+        std::string givenPass((char const*)pcktData->password, pcktData->passwordSize);
+        uint32_t clientsIVRandomPrefix = pcktData->clientsIVRandomPrefix;
 
-        // Check the DB, see if password is correct
-        LoginDatabase& db = g_server.GetDirectDB();
-        mysqlx::SqlStatement dStmt1 = db.Prepare(static_cast<int>(LoginDatabaseStatements::CHECK_PASSWORD));
-        dStmt1.bind(m_data.accountID);
-        mysqlx::SqlResult res = db.Execute(dStmt1);
+        // Check the DB on the worker that owns this account, the reply is made by the callback
+        auto& dbPool = g_server.GetDBWorkerPool();
+        {
+            TCPSocketManager* owner = m_owner;
+            SlotHandle handle = m_handle;
+
+            DBRequest req(false, static_cast<int>(LoginDatabaseStatements::CHECK_PASSWORD));
+            req.Bind(m_data.accountID);
+            req.m_callback = [owner, handle, givenPass = std::move(givenPass), clientsIVRandomPrefix](mysqlx::SqlResult* res) { return owner->DispatchDBCallback(handle, [&](AuthSession* s) { return s->DBCallback_AuthLoginProofPacket(res, givenPass, clientsIVRandomPrefix); }); };
+            req.m_respQueue = &owner->GetDBResponseQueue();
+            req.m_noticeFunc = [owner]() {return owner->WakeUp(); };
+            if (!dbPool.Enqueue(std::move(req), m_data.accountID))
+            {
+                LOG_WARNING("DB workers are overloaded, dropping the login of {}.", m_data.username);
+                return false;
+            }
+        }
 
-        mysqlx::Row row = res.fetchOne();
+        m_proofPending = true;
 
-        std::string givenPass((char const*)pcktData->password, pcktData->passwordSize);
+        return true;
+    }
+
+    bool AuthSession::DBCallback_AuthLoginProofPacket(mysqlx::SqlResult* result, const std::string& givenPass, uint32_t clientsIVRandomPrefix)
+    {
+        m_proofPending = false;
+
+        // Replying with a wrong password would be a lie, close now instead of letting the client wait for the timeout
+        if (!result)
+        {
+            LOG_WARNING("Could not verify the password of {}, closing the connection.", m_data.username);
+            return false;
+        }
+
+        // Reply to the client (the failure reply is just its first bytes)
+        Packet packet(sizeof(CPacketAuthLoginProof));
+
+        packet << uint8_t(PacketIDs::LOGIN_ATTEMPT);
 
-        bool authenticated = row[0].get<std::string>() == givenPass;
+        mysqlx::Row row = result->fetchOne();
 
-        auto& dbWorker = g_server.GetDBWorker();
+        // The account may have been deleted since the gather info
+        bool authenticated = row && row[0].get<std::string>() == givenPass;
+
+        // Everything this account writes is keyed by its accountID, so it all runs in order on the same worker
+        auto& dbPool = g_server.GetDBWorkerPool();
         if (!authenticated)
         {
             LOG_INFO("User {}  tried to send proof with a wrong password.", this->GetRemoteAddressAndPort());
 
             // Do an async insert on the DB worker to log that his IP tried to login with a wrong password
             {
-                DBRequest req(true, dbWorker.Prepare(static_cast<int>(LoginDatabaseStatements::INS_LOG_WRONG_PASSWORD)));
-                req.m_sqlStmt.bind(this->GetRemoteAddressAndPort());
-                req.m_sqlStmt.bind(m_data.username);
-                req.m_sqlStmt.bind("WRONG_PASSWORD");
-                dbWorker.Enqueue(std::move(req));
+                DBRequest req(true, static_cast<int>(LoginDatabaseStatements::INS_LOG_WRONG_PASSWORD));
+                req.Bind(this->GetRemoteAddressAndPort());
+                req.Bind(m_data.username);
+                req.Bind("WRONG_PASSWORD");
+
+                if (!dbPool.Enqueue(std::move(req), m_data.accountID))
+                {
+                    LOG_WARNING("DB workers are overloaded, the wrong password attempt of {} is not logged.", this->GetRemoteAddressAndPort());
+                }
             }
 
             packet << uint8_t(LoginProofResults::FAILED);
@@ -226,16 +306,22 @@ namespace Auth
             packet << uint16_t(sizeof(CPacketAuthLoginProof) - C_PACKET_AUTH_LOGIN_PROOF_INITIAL_SIZE); // Adjust the size appropriately, here we send the key
 
             // Calculate this side's IV, making sure it's different from the client's
-            while (pcktData->clientsIVRandomPrefix == m_data.iv.prefix)
+            while (clientsIVRandomPrefix == m_data.iv.prefix)
                 m_data.iv.RandomizePrefix();
 
             m_data.iv.ResetCounter();
 
-            LOG_INFO("Client's IV Random Prefix: {} | Server's IV Random Prefix: {}", pcktData->clientsIVRandomPrefix, m_data.iv.prefix);
+            LOG_INFO("Client's IV Random Prefix: {} | Server's IV Random Prefix: {}", clientsIVRandomPrefix, m_data.iv.prefix);
 
             // Calculate a random session key
             m_data.sessionKey = AES::GenerateSessionKey();
 
+            if (m_data.cipher.SetKey(m_data.sessionKey.data()) != 0)
+            {
+                LOG_ERROR("Could not set up the session cipher for user {}.", m_data.username);
+                return false;
+            }
+
             // Convert sessionKey to hex string in order to print it
             std::ostringstream sessionStrStream;
             for (int i = 0; i < AES_128_KEY_SIZE; ++i)
@@ -256,21 +342,32 @@ namespace Auth
             std::array<uint8_t, AES_128_KEY_SIZE> greetcode = AES::GenerateSessionKey();
 
             // Delete every previous sessions (if any) of this user, the game server will notice the new connection and kick him the previous client from the game
-            // Note: this works because there is only ONE database worker, so we can queue FIFO (if there were multiple workers, the second query (inserting new connection) could have been executed before deleting all the previous sessions, resulting in deleting the new insert as well)
+            // Note: this works because both requests are keyed by the accountID, so they land on the same database worker and are executed FIFO (otherwise the second query (inserting new connection) could be executed before deleting all the previous sessions, resulting in deleting the new insert as well)
             {
-                DBRequest req(true, dbWorker.Prepare(static_cast<int>(LoginDatabaseStatements::DEL_PREV_SESSIONS)));
-                req.m_sqlStmt.bind(m_data.accountID);
-                dbWorker.Enqueue(std::move(req));
+                DBRequest req(true, static_cast<int>(LoginDatabaseStatements::DEL_PREV_SESSIONS));
+                req.Bind(m_data.accountID);
+
+                if (!dbPool.Enqueue(std::move(req), m_data.accountID))
+                {
+                    LOG_WARNING("DB workers are overloaded, dropping the login of {}.", m_data.username);
+                    return false;
+                }
             }
 
             // Do an async insert on the DB worker to create a new active_session
             {
-                DBRequest req(true, dbWorker.Prepare(static_cast<int>(LoginDatabaseStatements::INS_NEW_SESSION)));
-                req.m_sqlStmt.bind(m_data.accountID);
-                req.m_sqlStmt.bind(mysqlx::bytes(m_data.sessionKey.data(), m_data.sessionKey.size()));
-                req.m_sqlStmt.bind(this->GetRemoteAddress());
-                req.m_sqlStmt.bind(mysqlx::bytes(greetcode.data(), greetcode.size()));
-                dbWorker.Enqueue(std::move(req));
+                DBRequest req(true, static_cast<int>(LoginDatabaseStatements::INS_NEW_SESSION));
+                req.Bind(m_data.accountID);
+                req.Bind(mysqlx::bytes(m_data.sessionKey.data(), m_data.sessionKey.size()));
+                req.Bind(this->GetRemoteAddress());
+                req.Bind(mysqlx::bytes(greetcode.data(), greetcode.size()));
+
+                // Without the active session the client couldn't enter the world, don't hand out the key
+                if (!dbPool.Enqueue(std::move(req), m_data.accountID))
+                {
+                    LOG_WARNING("DB workers are overloaded, dropping the login of {}.", m_data.username);
+                    return false;
+                }
             }
 
             // Write the greetcode to the packet
@@ -278,9 +375,12 @@ namespace Auth
             {
                 packet << greetcode[i];
             }
+
+            // Nothing else to do here, the client has a little time to read the reply before we close the connection
+            m_owner->EnterStage(this, SocketStatus::AUTHED);
         }
 
-        NetworkMessage m(packet);
+        NetworkMessage m(std::move(packet));
         QueuePacket(std::move(m));
 
         //Send(); packets are sent by checking POLLOUT events in the authSockets, and we check for POLLOUT events only if there are packets written in the outQueue
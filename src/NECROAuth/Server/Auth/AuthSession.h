@@ -5,16 +5,20 @@
 #include <AuthCodes.h>
 #include <unordered_map>
 #include <array>
+#include <chrono>
 
 #include <mysqlx/xdevapi.h>
 
 #include "AES.h"
+#include "SlotMap.h"
+#include "TimerWheel.h"
 
 namespace NECRO
 {
 namespace Auth
 {
     class AuthSession;
+    class TCPSocketManager;
     #pragma pack(push, 1)
 
     struct AuthHandler
@@ -32,6 +36,7 @@ namespace Auth
         uint32_t accountID; // accountid in the database
 
         std::array<uint8_t, AES_128_KEY_SIZE> sessionKey;
+        AES::SessionCipher cipher; // keyed with sessionKey, reused for every message of the session
         AES::IV iv;
 
         uint8_t versionMajor;
@@ -48,13 +53,31 @@ namespace Auth
     private:
         AccountData m_data;
 
+        // The manager (reactor) this session lives in, DB responses are routed back to it
+        TCPSocketManager* m_owner = nullptr;
+
+        // Where the session is in the owner's connection table, DB callbacks find the session through it
+        SlotHandle m_handle;
+
+        // True while the CHECK_PASSWORD request is on the DB worker
+        bool m_proofPending = false;
+
     public:
-        AuthSession(sock_t socket) : TCPSocket(socket), m_status(SocketStatus::GATHER_INFO) 
+        AuthSession(sock_t socket) : TCPSocket(socket), m_status(SocketStatus::TLS_HANDSHAKE) 
         {
         }
 
         SocketStatus m_status;
 
+        // Deadline of the current stage in the owner's timer wheel, the session is closed if it's still in the stage when it expires
+        TimerHandle m_stageTimer;
+
+        // Handshake offload (HandshakeWorkerPool). The flags are only used by the reactor, m_handshakeResult is written by the worker before handing the session back
+        bool m_handshakeInWorker = false;
+        bool m_handshakeEventPending = false;   // the socket became ready while the worker had it
+        bool m_closeAfterHandshakeStep = false; // closing was requested while the worker had it
+        int  m_handshakeResult = 0;
+
         static std::unordered_map<uint8_t, AuthHandler> InitHandlers();
 
         AccountData& GetAccountData()
@@ -62,13 +85,41 @@ namespace Auth
             return m_data;
         }
 
+        void SetOwner(TCPSocketManager* owner)
+        {
+            m_owner = owner;
+        }
+
+        TCPSocketManager* GetOwner()
+        {
+            return m_owner;
+        }
+
+        void SetHandle(SlotHandle handle)
+        {
+            m_handle = handle;
+        }
+
+        SlotHandle GetHandle() const
+        {
+            return m_handle;
+        }
+
         void ReadCallback() override;
 
+        // An offloaded handshake step is back on the reactor, the poll interest depends on what the handshake needs next
+        void RefreshPollEvents()
+        {
+            UpdatePollEvents();
+        }
+
         // Handlers functions
         bool HandleAuthLoginGatherInfoPacket();
-        bool DBCallback_AuthLoginGatherInfoPacket(mysqlx::SqlResult& result);
+        bool DBCallback_AuthLoginGatherInfoPacket(mysqlx::SqlResult* result);
+        bool SendAuthLoginGatherInfoReply(bool accountExists, uint32_t accountID);
 
         bool HandleAuthLoginProofPacket();
+        bool DBCallback_AuthLoginProofPacket(mysqlx::SqlResult* result, const std::string& givenPass, uint32_t clientsIVRandomPrefix);
 
 
     };
@@ -0,0 +1,78 @@
+#include "HandshakeWorkerPool.h"
+
+#include "AuthSession.h"
+#include "TCPSocketManager.h"
+
+namespace NECRO
+{
+namespace Auth
+{
+	HandshakeWorkerPool::~HandshakeWorkerPool()
+	{
+		Stop();
+	}
+
+	int HandshakeWorkerPool::Start(size_t threadsCount)
+	{
+		if (!m_threads.empty())
+			return -1;
+
+		m_running = true;
+
+		for (size_t i = 0; i < threadsCount; i++)
+			m_threads.emplace_back(&HandshakeWorkerPool::ThreadRoutine, this);
+
+		return 0;
+	}
+
+	void HandshakeWorkerPool::Stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_running = false;
+		}
+
+		m_cond.notify_all();
+
+		for (std::thread& t : m_threads)
+			if (t.joinable())
+				t.join();
+
+		m_threads.clear();
+		m_jobs.clear();
+	}
+
+	void HandshakeWorkerPool::Post(AuthSession* session)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_jobs.push_back(session);
+		}
+
+		m_cond.notify_one();
+	}
+
+	void HandshakeWorkerPool::ThreadRoutine()
+	{
+		while (true)
+		{
+			AuthSession* session;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_cond.wait(lock, [this] { return !m_running || !m_jobs.empty(); });
+
+				if (!m_running)
+					break;
+
+				session = m_jobs.front();
+				m_jobs.pop_front();
+			}
+
+			// The expensive part, the reactor is meanwhile serving its other sessions
+			session->m_handshakeResult = session->TLSAcceptStep();
+
+			session->GetOwner()->CompleteOffloadedHandshake(session);
+		}
+	}
+}
+}
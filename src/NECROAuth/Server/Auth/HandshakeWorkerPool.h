@@ -0,0 +1,49 @@
+#ifndef NECROAUTH_HANDSHAKE_WORKER_POOL_H
+#define NECROAUTH_HANDSHAKE_WORKER_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace NECRO
+{
+namespace Auth
+{
+	class AuthSession;
+
+	//-----------------------------------------------------------------------------------------------------
+	// Threads that run the TLS handshake steps (SSL_accept, with its certificate signature) on behalf of the reactors.
+	// A reactor posts a session when its socket is ready, a worker advances the handshake as far as the socket allows
+	// and hands the session back to its reactor (TCPSocketManager::CompleteOffloadedHandshake), which goes on polling it.
+	// A session is owned by the worker for the whole step: the reactor doesn't touch it until it comes back.
+	//-----------------------------------------------------------------------------------------------------
+	class HandshakeWorkerPool
+	{
+	private:
+		std::vector<std::thread>	m_threads;
+
+		std::mutex					m_mutex;
+		std::condition_variable		m_cond;
+		std::deque<AuthSession*>	m_jobs;
+		bool						m_running = false;
+
+		void ThreadRoutine();
+
+	public:
+		~HandshakeWorkerPool();
+
+		int		Start(size_t threadsCount);
+		void	Stop();
+
+		// With no threads the reactors run the handshakes themselves
+		bool	IsEnabled() const { return !m_threads.empty(); }
+		size_t	GetSize() const { return m_threads.size(); }
+
+		void	Post(AuthSession* session);
+	};
+}
+}
+
+#endif
@@ -16,8 +16,13 @@ namespace Auth
 	//-----------------------------------------------------------------------------------------------------
 	// Abstracts a TCP Socket Listener into a manager, that listens, accepts and manages connections
 	//-----------------------------------------------------------------------------------------------------
-	TCPSocketManager::TCPSocketManager(SocketAddressesFamily _family) : m_listener(_family), m_wakeListen(_family), m_wakeWrite(_family)
+	TCPSocketManager::TCPSocketManager(SocketAddressesFamily _family, int id, SocketPoller::Backend backend) : m_id(id), m_listener(_family), m_timers(std::chrono::milliseconds(TIMER_RESOLUTION_MS)), m_handshakeDone(g_server.GetMaxHandshakes())
 	{
+		m_poller = SocketPoller::Create(backend);
+
+		// One response ring per DB worker
+		m_dbResponses.Setup(g_server.GetDBWorkerPool().GetSize());
+
 		uint16_t inPort = 61531;
 		SocketAddress localAddr(AF_INET, INADDR_ANY, inPort);
 		int flag = 1;
@@ -25,81 +30,172 @@ namespace Auth
 		m_listener.SetSocketOption(IPPROTO_TCP, TCP_NODELAY, (char*)&flag, sizeof(int));
 		m_listener.SetSocketOption(SOL_SOCKET, SO_REUSEADDR, (char*)&flag, sizeof(int));
 
+#ifdef SO_REUSEPORT
+		// Every manager has its own listener bound to the same port, the kernel load-balances the accepts
+		m_listener.SetSocketOption(SOL_SOCKET, SO_REUSEPORT, (char*)&flag, sizeof(int));
+#endif
+
+#ifdef TCP_DEFER_ACCEPT
+		// Don't wake up for a connection until the client has sent something (the ClientHello), or the timeout has expired
+		int deferAcceptSeconds = g_server.GetDeferAcceptSeconds();
+		if (deferAcceptSeconds > 0)
+			m_listener.SetSocketOption(IPPROTO_TCP, TCP_DEFER_ACCEPT, (char*)&deferAcceptSeconds, sizeof(int));
+#endif
+
 		m_listener.Bind(localAddr);
 		m_listener.SetBlockingEnabled(false);
 		m_listener.Listen();
 
-		// Initialize the pollfds vector
-		pollfd pfd;
-		pfd.fd = m_listener.GetSocketFD();
-		pfd.events = POLLIN;
-		pfd.revents = 0;
-		m_poll_fds.push_back(pfd);
+		// Register the listener, level-triggered so connections we don't accept in this round are reported again in the next one
+		m_poller->Add(m_listener.GetSocketFD(), POLLIN, false, &m_listener);
+
+		if (SetupWakeup() != 0)
+		{
+			LOG_ERROR("Could not setup the wake up channel for reactor {}.", m_id);
+			throw std::runtime_error("Failed to setup the wake up channel.");
+		}
+	}
 
-		//pollfd wakefd = SetupWakeup();
-		//m_poll_fds.push_back(wakefd);
+	TCPSocketManager::~TCPSocketManager()
+	{
+		CloseWakeup();
 	}
 
-	pollfd TCPSocketManager::SetupWakeup()
+	//-----------------------------------------------------------------------------------------------------
+	// Whether more than one manager can listen on the same port
+	//-----------------------------------------------------------------------------------------------------
+	bool TCPSocketManager::SupportsListenerSharding()
 	{
+#ifdef SO_REUSEPORT
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	//-----------------------------------------------------------------------------------------------------
+	// Whether the listener can hold the connections back until their first data arrives
+	//-----------------------------------------------------------------------------------------------------
+	bool TCPSocketManager::SupportsDeferAccept()
+	{
+#ifdef TCP_DEFER_ACCEPT
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	//-----------------------------------------------------------------------------------------------------
+	// Creates the wake up channel and registers its read side in the poller
+	//-----------------------------------------------------------------------------------------------------
+	int TCPSocketManager::SetupWakeup()
+	{
+#ifdef NECRO_HAS_EVENTFD
+		m_wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+		if (m_wakeFd < 0)
+		{
+			LOG_ERROR("eventfd() failed with error: {}", SocketUtility::GetLastError());
+			return -1;
+		}
+
+		// The manager itself is the userData of the wake up slot
+		return m_poller->Add(m_wakeFd, POLLIN, false, this);
+#else
 		// Make the wake up read listen
 		int flag = 1;
 
-		m_wakeListen.Bind(SocketAddress(AF_INET, htonl(INADDR_LOOPBACK), 0));
-		m_wakeListen.Listen(1);
+		TCPSocket wakeListen(SocketAddressesFamily::INET);
+		wakeListen.Bind(SocketAddress(AF_INET, htonl(INADDR_LOOPBACK), 0));
+		wakeListen.Listen(1);
 
 		sockaddr_in wakeReadAddr;
-		int len = sizeof(wakeReadAddr);
-		if (getsockname(m_wakeListen.GetSocketFD(), (sockaddr*)&wakeReadAddr, &len) == SOCKET_ERROR)
+		socklen_t len = sizeof(wakeReadAddr);
+		if (getsockname(wakeListen.GetSocketFD(), (sockaddr*)&wakeReadAddr, &len) == SOCKET_ERROR)
 		{
-			LOG_ERROR("getsockname() failed with error: {}", WSAGetLastError());
-			throw std::runtime_error("Failed to get socket address.");
+			LOG_ERROR("getsockname() failed with error: {}", SocketUtility::GetLastError());
+			return -1;
 		}
 		
 		// Connect on the Write side
-		m_wakeWrite.Connect(SocketAddress(*reinterpret_cast<sockaddr*>(&wakeReadAddr)));
+		m_wakeWrite = std::make_unique<TCPSocket>(SocketAddressesFamily::INET);
+		if (m_wakeWrite->Connect(SocketAddress(*reinterpret_cast<sockaddr*>(&wakeReadAddr))) != SocketUtility::SU_NO_ERROR_VAL)
+			return -1;
 
-		m_wakeWrite.SetBlockingEnabled(false);
-		m_wakeWrite.SetSocketOption(IPPROTO_TCP, TCP_NODELAY, (char*)&flag, sizeof(int));
+		m_wakeWrite->SetBlockingEnabled(false);
+		m_wakeWrite->SetSocketOption(IPPROTO_TCP, TCP_NODELAY, (char*)&flag, sizeof(int));
+
+		// Accept the connection on the read side, the listener is not needed anymore after that
+		sock_t accepted = wakeListen.AcceptSys();
+		if (accepted == INVALID_SOCKET)
+		{
+			LOG_ERROR("Could not accept the wake up connection [{}]", SocketUtility::GetLastError());
+			return -1;
+		}
 
-		// Accept the connection on the read side
-		SocketAddress dummy;
-		sock_t accepted = m_wakeListen.AcceptSys();
 		m_wakeRead = std::make_unique<TCPSocket>(accepted);
+		m_wakeRead->SetBlockingEnabled(false);
 
-		m_wakeListen.SetBlockingEnabled(false);
-		m_wakeListen.SetSocketOption(IPPROTO_TCP, TCP_NODELAY, (char*)&flag, sizeof(int));
+		// The manager itself is the userData of the wake up slot
+		return m_poller->Add(m_wakeRead->GetSocketFD(), POLLIN, false, this);
+#endif
+	}
 
-		pollfd wakefd;
-		wakefd.fd = m_wakeRead->GetSocketFD();
-		wakefd.events = POLLIN;
-		wakefd.revents = 0;
+	void TCPSocketManager::CloseWakeup()
+	{
+#ifdef NECRO_HAS_EVENTFD
+		if (m_wakeFd >= 0)
+		{
+			m_poller->Remove(m_wakeFd);
+			close(m_wakeFd);
+			m_wakeFd = -1;
+		}
+#else
+		if (m_wakeRead)
+		{
+			m_poller->Remove(m_wakeRead->GetSocketFD());
+			m_wakeRead.reset();
+		}
 
-		return wakefd;
+		m_wakeWrite.reset();
+#endif
 	}
 
-	int TCPSocketManager::Poll()
+	//-----------------------------------------------------------------------------------------------------
+	// Consumes the wake up notification and runs the callbacks of the DB responses that woke us up
+	//-----------------------------------------------------------------------------------------------------
+	void TCPSocketManager::HandleWakeup()
 	{
-		static int timeout = 3000;	// wait forever until at least one socket has an event
-
-		LOG_CRITICAL("WAKEN UP!!! ACQUIRING MUTEX....");
-		// Execute the callbacks
-		std::queue<DBRequest> requests = g_server.GetDBWorker().GetResponseQueue();
-		LOG_CRITICAL("MUTEX ACQUIRED!!!");
+#ifdef NECRO_HAS_EVENTFD
+		uint64_t count;
+		while (read(m_wakeFd, &count, sizeof(count)) > 0)
+			;
+#else
+		char buf[128];
+		while (m_wakeRead->SysReceive(buf, sizeof(buf)) > 0)
+			;
+#endif
+
+		// Clear before draining, so a response pushed after the drain wakes us up again
+		m_wakeupPending.store(false, std::memory_order_release);
+
+		ExecuteDBCallbacks();
+		DrainHandshakeCompletions();
+	}
 
-		while (requests.size() > 0)
-		{
-			LOG_CRITICAL("SERVING A REQUEST!!!");
-			DBRequest r = std::move(requests.front());
-			requests.pop();
-			r.m_callback(r.m_sqlRes);
-		}
+	void TCPSocketManager::ExecuteDBCallbacks()
+	{
+		m_dbResponses.Drain([](DBRequest& r) { r.m_callback(r.m_failed ? nullptr : &r.m_sqlRes); });
+	}
 
-		LOG_CRITICAL("LEAVING!!!");
+	int TCPSocketManager::Poll()
+	{
+		static int timeout = -1;	// wait forever until at least one socket has an event, DB responses and Stop() wake us up through the wake up channel
 
-		LOG_DEBUG("Polling {}", m_list.size());
+		LOG_DEBUG("[Reactor {}] Polling {}", m_id, m_sessions.Size());
 
-		int res = WSAPoll(m_poll_fds.data(), m_poll_fds.size(), timeout);
+		// Only the sockets that are ready are returned
+		int res = m_poller->Wait(m_events, GetWaitTimeout(timeout));
 
 		// Check for errors
 		if (res < 0)
@@ -111,192 +207,432 @@ namespace Auth
 		// Check for timeout
 		if (res == 0)
 		{
+			ExpireTimers();
+			RemoveClosedSessions();
 			return 0;
 		}
 
-		// Check for the listener (index 0)
-		if (m_poll_fds[0].revents != 0)
+		// Sessions that failed during this round, we'll deregister them after having dispatched all the events
+		std::vector<AuthSession*> toRemove;
+
+		for (const SocketPoller::Event& ev : m_events)
 		{
-			if (m_poll_fds[0].revents & (POLLERR | POLLHUP | POLLNVAL))
-			{
-				LOG_ERROR("Listener encountered an error.");
-				return -1;
-			}
-			// If there's a reading event for the listener socket, it's a new connection
-			else if (m_poll_fds[0].revents & POLLIN)
+			// Check for WakeUp
+			if (ev.userData == this)
 			{
-				SocketAddress otherAddr;
-				if (std::shared_ptr<AuthSession> inSock = m_listener.Accept<AuthSession>(otherAddr))
+				if (ev.revents & (POLLERR | POLLHUP | POLLNVAL))
 				{
-					LOG_INFO("New connection! Setting up TLS and handshaking...");
-
-					inSock->ServerTLSSetup("localhost");
-
-					bool success = true;
-					int ret = 0;
-					// Perform the handshake
-					while ((ret = SSL_accept(inSock->GetSSL())) != 1)
-					{
-						int err = SSL_get_error(inSock->GetSSL(), ret);
-
-						// Keep trying
-						if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE)
-							continue;
-
-						if (err == SSL_ERROR_WANT_CONNECT || err == SSL_ERROR_WANT_ACCEPT)
-							continue;
-
-						if (err == SSL_ERROR_ZERO_RETURN)
-						{
-							LOG_INFO("TLS connection closed by peer during handshake.");
-							success = false;
-							break;
-						}
-
-						if (err == SSL_ERROR_SYSCALL)
-						{
-							LOG_ERROR("System call error during TLS handshake. Ret: {}.", ret);
-							success = false;
-							break;
-						}
-
-						if (err == SSL_ERROR_SSL)
-						{
-							if (SSL_get_verify_result(inSock->GetSSL()) != X509_V_OK)
-								LOG_ERROR("Verify error: {}\n", X509_verify_cert_error_string(SSL_get_verify_result(inSock->GetSSL())));
-						}
-
-						LOG_ERROR("TLSPerformHandshake failed!");
-						success = false;
-						break;
-					}
-
-					if (success)
-					{
-						LOG_OK("TLSPerformHandshake succeeded!");
-
-						// Initialize status
-						inSock->m_status = SocketStatus::GATHER_INFO;
-						m_list.push_back(inSock); // save it in the active list
-
-						// Add the new connection to the pfds
-						pollfd newPfd;
-						newPfd.fd = inSock->GetSocketFD();
-						newPfd.events = POLLIN;
-						newPfd.revents = 0;
-						m_poll_fds.push_back(newPfd);
-
-						// Set inSock PFD pointer with the one we've just created and put in the vector
-						inSock->SetPfd(&m_poll_fds[m_poll_fds.size() - 1]);
-					}
+					LOG_ERROR("WakeUp encountered an error.");
+					return -1;
 				}
+
+				HandleWakeup();
+				continue;
+			}
+
+			// Check for the listener
+			if (ev.userData == &m_listener)
+			{
+				if (HandleListenerEvent(ev.revents) < 0)
+					return -1;
+
+				continue;
+			}
+
+			// Check for clients
+			AuthSession* session = static_cast<AuthSession*>(ev.userData);
+
+			if (!HandleSessionEvent(session, ev.revents))
+			{
+				LOG_INFO("Client socket error/disconnection detected. Removing it later.");
+				toRemove.push_back(session);
 			}
 		}
 
-		/*
-		// Check for WakeUp
-		if (m_poll_fds[1].revents != 0)
+		for (AuthSession* session : toRemove)
+			CloseSession(session);
+
+		ExpireTimers();
+		RemoveClosedSessions();
+
+		return 0;
+	}
+
+	int TCPSocketManager::HandleListenerEvent(short revents)
+	{
+		if (revents & (POLLERR | POLLHUP | POLLNVAL))
 		{
-			if(m_poll_fds[1].revents & (POLLERR | POLLHUP | POLLNVAL))
+			LOG_ERROR("Listener encountered an error.");
+			return -1;
+		}
+
+		// If there's a reading event for the listener socket, it's a new connection
+		if (!(revents & POLLIN))
+			return 0;
+
+		// Drain the backlog until it would block, up to ACCEPT_BATCH_MAX so the clients already connected are served too
+		for (int accepted = 0; accepted < ACCEPT_BATCH_MAX; accepted++)
+		{
+			// Too many handshakes going on, leave the new ones in the backlog
+			if (m_handshakesInFlight >= g_server.GetMaxHandshakes())
 			{
-				LOG_ERROR("WakeUp encountered an error.");
-				return -1;
+				UpdateListenerInterest();
+				break;
 			}
-			else if (m_poll_fds[1].revents & POLLIN)
-			{
-				// We gotten waken up by the DBWorker
 
-				// Consume what was sent
-				char buf[128];
-				m_wakeRead->SysReceive(buf, sizeof(buf));
+			// The handshake is performed non-blocking, one step every time the socket is ready, so a slow client can't stall the others
+			SocketAddress otherAddr;
+			std::shared_ptr<AuthSession> inSock = m_listener.Accept<AuthSession>(otherAddr, true);
+			if (!inSock)
+				break;
 
-				LOG_CRITICAL("WAKEN UP!!! ACQUIRING MUTEX....");
-				// Execute the callbacks
-				std::queue<DBRequest> requests = g_server.GetDBWorker().GetResponseQueue();
-				LOG_CRITICAL("MUTEX ACQUIRED!!!");
+			LOG_INFO("New connection! Setting up TLS, the handshake will be driven by the poller...");
 
-				while (requests.size() > 0)
-				{
-					LOG_CRITICAL("SERVING A REQUEST!!!");
-					DBRequest r = std::move(requests.front());
-					requests.pop();
-					r.m_callback(r.m_sqlRes);
-				}
+			inSock->ServerTLSSetup("localhost");
+
+			// Initialize status
+			inSock->SetOwner(this);
+			inSock->SetHandle(m_sessions.Insert(inSock)); // save it in the connections table
 
-				LOG_CRITICAL("LEAVING!!!");
+			// Register the new connection in the poller (edge-triggered, the session is drained until it would block every time it's reported ready)
+			// POLLOUT will be armed by the socket itself when it queues something or when the handshake needs it
+			if (m_poller->Add(inSock->GetSocketFD(), POLLIN, true, inSock.get()) != 0)
+			{
+				inSock->m_status = SocketStatus::CLOSED;
+				inSock->Close();
+				m_sessions.Remove(inSock->GetHandle());
+				continue;
 			}
+
+			inSock->SetPoller(m_poller.get());
+
+			EnterStage(inSock.get(), SocketStatus::TLS_HANDSHAKE);
+			m_handshakesInFlight++;
+			UpdateListenerInterest();
+
+			// The ClientHello may already be here
+			if (!ContinueHandshake(inSock.get()))
+				CloseSession(inSock.get());
+		}
+
+		return 0;
+	}
+
+	//-----------------------------------------------------------------------------------------------------
+	// Performs a step of the TLS handshake, returns false if the session has to be removed
+	//-----------------------------------------------------------------------------------------------------
+	bool TCPSocketManager::ContinueHandshake(AuthSession* session)
+	{
+		HandshakeWorkerPool& pool = g_server.GetHandshakePool();
+
+		if (!pool.IsEnabled())
+			return FinishHandshakeStep(session, session->TLSAccept());
+
+		// A worker has it already, it'll be posted again when it comes back
+		if (session->m_handshakeInWorker)
+		{
+			session->m_handshakeEventPending = true;
+			return true;
 		}
-		*/
 
-		// Vector of indexes of invalid sockets we'll remove after the client check
-		std::vector<int> toRemove;
+		session->m_handshakeInWorker = true;
+		session->m_handshakeEventPending = false;
+		pool.Post(session);
+
+		return true;
+	}
+
+	//-----------------------------------------------------------------------------------------------------
+	// Handles the result of a handshake step, returns false if the session has to be removed
+	//-----------------------------------------------------------------------------------------------------
+	bool TCPSocketManager::FinishHandshakeStep(AuthSession* session, int result)
+	{
+		if (result < 0)
+			return false;
+
+		if (result == 0)
+			return true; // waiting for more data or for the socket to become writable
+
+		LOG_OK("TLS handshake succeeded!");
+
+		EnterStage(session, SocketStatus::GATHER_INFO);
+		m_handshakesInFlight--;
+		UpdateListenerInterest();
+
+		// The client sends its first packet as soon as its side of the handshake is done, it may be already here
+		return HandleSessionEvent(session, POLLIN);
+	}
+
+	void TCPSocketManager::CompleteOffloadedHandshake(AuthSession* session)
+	{
+		// Can't be full (see m_handshakeDone), but don't lose a session if it ever is
+		while (!m_handshakeDone.TryPush(std::move(session)))
+			std::this_thread::yield();
+
+		WakeUp();
+	}
 
-		// Check for clients
-		for (size_t i = 1; i < m_poll_fds.size(); i++)
+	//-----------------------------------------------------------------------------------------------------
+	// Takes back the sessions whose offloaded handshake step is done
+	//-----------------------------------------------------------------------------------------------------
+	void TCPSocketManager::DrainHandshakeCompletions()
+	{
+		while (m_handshakeDone.Front())
 		{
-			if (m_poll_fds[i].revents & (POLLERR | POLLHUP | POLLNVAL))
+			AuthSession* session = m_handshakeDone.PopFront();
+			session->m_handshakeInWorker = false;
+
+			if (session->m_closeAfterHandshakeStep)
 			{
-				LOG_INFO("Client socket error/disconnection detected. Removing it later.");
-				toRemove.push_back(i); // i is the fds index, but in connection list it's i-2
+				CloseSession(session);
+				continue;
 			}
-			else
+
+			int r = session->m_handshakeResult;
+
+			if (r >= 0)
+				session->RefreshPollEvents();
+
+			// The socket became ready again while the worker had it (edge-triggered: we won't be told twice)
+			if (r == 0 && session->m_handshakeEventPending)
 			{
-				// If the socket is writable AND we're looking for POLLOUT events as well (meaning there's something on the outQueue), send it!
-				if (m_poll_fds[i].revents & POLLOUT)
-				{
-					int r = m_list[i - 1]->Send();
-
-					// If send failed
-					if (r < 0)
-					{
-						LOG_INFO("Client socket error/disconnection detected. Removing it later.");
-						toRemove.push_back(i); // i is the fds index, but in connection list it's i-2
-						continue;
-					}
-				}
+				if (!ContinueHandshake(session))
+					CloseSession(session);
 
-				if (m_poll_fds[i].revents & POLLIN)
-				{
-					int r = m_list[i - 1]->Receive();
-
-					// If receive failed, 
-					if (r < 0)
-					{
-						LOG_INFO("Client socket error/disconnection detected. Removing it later.");
-						toRemove.push_back(i); // i is the fds index, but in connection list it's i-2
-						continue;
-					}
-				}
+				continue;
 			}
+
+			if (!FinishHandshakeStep(session, r))
+				CloseSession(session);
+		}
+	}
+
+	//-----------------------------------------------------------------------------------------------------
+	// Stops polling the listener while the handshakes in flight are at the cap, resumes when they're not
+	//-----------------------------------------------------------------------------------------------------
+	void TCPSocketManager::UpdateListenerInterest()
+	{
+		bool atCap = m_handshakesInFlight >= g_server.GetMaxHandshakes();
+
+		if (atCap == m_listenerPaused)
+			return;
+
+		if (m_poller->Modify(m_listener.GetSocketFD(), atCap ? 0 : POLLIN, false, &m_listener) != 0)
+			return;
+
+		m_listenerPaused = atCap;
+
+		if (atCap)
+		{
+			LOG_WARNING("Reactor {} has {} TLS handshakes in flight, new connections will wait in the backlog.", m_id, m_handshakesInFlight);
+		}
+	}
+
+	//-----------------------------------------------------------------------------------------------------
+	// Closing deregisters the socket from the poller, the session is removed from the table at the end of the Poll()
+	//-----------------------------------------------------------------------------------------------------
+	void TCPSocketManager::CloseSession(AuthSession* session)
+	{
+		if (session->m_status == SocketStatus::CLOSED)
+			return;
+
+		// A worker is using its SSL object, close it when the step comes back
+		if (session->m_handshakeInWorker)
+		{
+			session->m_closeAfterHandshakeStep = true;
+			return;
+		}
+
+		if (session->m_status == SocketStatus::TLS_HANDSHAKE)
+		{
+			m_handshakesInFlight--;
+			UpdateListenerInterest();
+		}
+
+		m_timers.Cancel(session->m_stageTimer);
+
+		session->m_status = SocketStatus::CLOSED;
+		session->Close();
+
+		m_closedSessions.push_back(session->GetHandle());
+	}
+
+	//-----------------------------------------------------------------------------------------------------
+	// Destroys the sessions closed during this Poll(). DB responses still on the way for them resolve to nothing
+	//-----------------------------------------------------------------------------------------------------
+	void TCPSocketManager::RemoveClosedSessions()
+	{
+		for (SlotHandle handle : m_closedSessions)
+			m_sessions.Remove(handle);
+
+		m_closedSessions.clear();
+	}
+
+	AuthSession* TCPSocketManager::GetSessionForDBResponse(SlotHandle handle)
+	{
+		AuthSession* session = GetSession(handle);
+
+		if (!session)
+		{
+			LOG_DEBUG("Dropping a DB response, its session has been closed meanwhile.");
+		}
+
+		return session;
+	}
+
+	//-----------------------------------------------------------------------------------------------------
+	// How long a session can stay in status before it's disconnected, -1 if there's no limit
+	//-----------------------------------------------------------------------------------------------------
+	int TCPSocketManager::GetStageTimeoutMs(SocketStatus status)
+	{
+		switch (status)
+		{
+		case SocketStatus::TLS_HANDSHAKE:
+			return TLS_HANDSHAKE_TIMEOUT_MS;
+
+		case SocketStatus::GATHER_INFO:
+			return GATHER_INFO_TIMEOUT_MS;
+
+		case SocketStatus::LOGIN_ATTEMPT:
+			return LOGIN_PROOF_TIMEOUT_MS;
+
+		case SocketStatus::AUTHED:
+			return AUTHED_LINGER_MS;
+
+		default:
+			return -1;
+		}
+	}
+
+	//-----------------------------------------------------------------------------------------------------
+	// Moves the session to status and replaces the deadline of the previous stage with the one of the new stage
+	//-----------------------------------------------------------------------------------------------------
+	void TCPSocketManager::EnterStage(AuthSession* session, SocketStatus status)
+	{
+		session->m_status = status;
+
+		m_timers.Cancel(session->m_stageTimer);
+		session->m_stageTimer = TimerHandle();
+
+		int timeoutMs = GetStageTimeoutMs(status);
+		if (timeoutMs >= 0)
+			session->m_stageTimer = m_timers.Arm(std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs), session->GetHandle());
+	}
+
+	//-----------------------------------------------------------------------------------------------------
+	// Disconnects the sessions whose stage deadline has expired
+	//-----------------------------------------------------------------------------------------------------
+	void TCPSocketManager::ExpireTimers()
+	{
+		m_timers.Advance(std::chrono::steady_clock::now(), [this](SlotHandle& handle) { OnStageTimeout(handle); });
+	}
+
+	void TCPSocketManager::OnStageTimeout(SlotHandle handle)
+	{
+		// Timers are cancelled when their session is closed, a stale one resolves to nothing
+		AuthSession* session = GetSession(handle);
+
+		if (!session)
+			return;
+
+		session->m_stageTimer = TimerHandle();
+
+		switch (session->m_status)
+		{
+		case SocketStatus::TLS_HANDSHAKE:
+			LOG_INFO("Client {} did not complete the TLS handshake in time. Closing the connection.", session->GetRemoteAddressAndPort());
+			break;
+
+		case SocketStatus::GATHER_INFO:
+			LOG_INFO("Client {} did not send its login info in time. Closing the connection.", session->GetRemoteAddressAndPort());
+			break;
+
+		case SocketStatus::LOGIN_ATTEMPT:
+			LOG_INFO("Client {} did not complete the login in time. Closing the connection.", session->GetRemoteAddressAndPort());
+			break;
+
+		default:
+			LOG_DEBUG("Client {} is done with the login, closing the connection.", session->GetRemoteAddressAndPort());
+			break;
 		}
 
-		/*
-		if (toRemove.size() > 0)
+		CloseSession(session);
+	}
+
+	//-----------------------------------------------------------------------------------------------------
+	// Returns how long the poller can sleep without missing a stage deadline
+	//-----------------------------------------------------------------------------------------------------
+	int TCPSocketManager::GetWaitTimeout(int maxTimeout)
+	{
+		return m_timers.GetTimeout(std::chrono::steady_clock::now(), maxTimeout);
+	}
+
+	//-----------------------------------------------------------------------------------------------------
+	// Dispatches the events of a ready session, returns false if the session has to be removed
+	//-----------------------------------------------------------------------------------------------------
+	bool TCPSocketManager::HandleSessionEvent(AuthSession* session, short revents)
+	{
+		if (!session->IsOpen())
+			return false;
+
+		if (revents & (POLLERR | POLLHUP | POLLNVAL))
+			return false;
+
+		// Still handshaking, whatever the event was SSL_accept will tell us what it needs next
+		if (session->m_status == SocketStatus::TLS_HANDSHAKE)
+			return ContinueHandshake(session);
+
+		// If the socket is writable AND we're looking for POLLOUT events as well (meaning there's something on the outQueue), send it!
+		if (revents & POLLOUT)
 		{
-			// Remove socket from list and fds, in reverse order to avoid index shift
-			std::sort(toRemove.begin(), toRemove.end(), std::greater<int>());
-			for (int idx : toRemove)
+			// Send until the queue is empty or the socket would block
+			while (session->HasPendingData())
 			{
-				LOG_DEBUG("Removing pollfd[{}] and list[{}].", idx, idx - 1);
+				int r = session->Send();
 
-				m_list[idx - 1]->Close(); // -2 because we have both 0 (listener) and 1 (loopback)
+				// If send failed
+				if (r < 0)
+					return false;
 
-				m_poll_fds.erase(m_poll_fds.begin() + idx);
-				m_list.erase(m_list.begin() + (idx - 1));
+				if (r == 0)
+					break;
 			}
 		}
-		*/
 
-		return 0;
+		if (revents & POLLIN)
+		{
+			// Receive until the socket would block (required by edge-triggered notifications)
+			int r;
+			while ((r = session->Receive()) > 0)
+				;
+
+			// If receive failed, 
+			if (r < 0)
+				return false;
+		}
+
+		return session->IsOpen();
 	}
 
+	//-----------------------------------------------------------------------------------------------------
+	// Thread-safe, wakes up the reactor if it's blocked in Wait(). Calls made before the reactor handled
+	// the previous one are coalesced
+	//-----------------------------------------------------------------------------------------------------
 	void TCPSocketManager::WakeUp()
 	{
-		/*
-		LOG_CRITICAL("WAKING UP CALLED");
+		if (m_wakeupPending.exchange(true, std::memory_order_acq_rel))
+			return; // already pending, the reactor will see everything that's been queued so far
+
+#ifdef NECRO_HAS_EVENTFD
+		uint64_t one = 1;
+		if (write(m_wakeFd, &one, sizeof(one)) < 0 && !SocketUtility::ErrorIsWouldBlock())
+		{
+			LOG_ERROR("Could not write on the wake up eventfd [{}]", SocketUtility::GetLastError());
+		}
+#else
 		char dummy = 0;
-		m_wakeWrite.SysSend(&dummy, sizeof(dummy));
-		*/
+		m_wakeWrite->SysSend(&dummy, sizeof(dummy));
+#endif
 	}
 
 }
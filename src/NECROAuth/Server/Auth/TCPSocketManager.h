@@ -2,11 +2,23 @@
 #define TCP_SOCKET_MANAGER
 
 #include "AuthSession.h"
+#include "SocketPoller.h"
+#include "DBResponseQueue.h"
+#include "MPSCQueue.h"
+#include "SlotMap.h"
+#include "TimerWheel.h"
 
 #include "ConsoleLogger.h"
 #include "FileLogger.h"
 
 #include <unordered_map>
+#include <chrono>
+#include <atomic>
+
+#ifdef __linux__
+	#define NECRO_HAS_EVENTFD 1
+	#include <sys/eventfd.h>
+#endif
 
 namespace NECRO
 {
@@ -14,37 +26,159 @@ namespace Auth
 {
 	//-----------------------------------------------------------------------------------------------------
 	// Abstracts a TCP Socket Listener into a manager, that listens, accepts and manages connections
+	// Every manager is a reactor that runs on its own thread. Where SO_REUSEPORT is available each one
+	// binds its own listener on the same port, and the kernel spreads the incoming connections among them
 	//-----------------------------------------------------------------------------------------------------
 	class TCPSocketManager
 	{
 	public:
+		// Every stage of the login has its own deadline, armed when the session enters it. Clients that are still in the stage when it expires are disconnected
+		static constexpr int TLS_HANDSHAKE_TIMEOUT_MS = 5000;
+		static constexpr int GATHER_INFO_TIMEOUT_MS = 10000;
+		static constexpr int LOGIN_PROOF_TIMEOUT_MS = 15000;	// includes the password check on the DB worker
+		static constexpr int AUTHED_LINGER_MS = 2000;			// time the client has to read the session key and leave on its own
+
+		// Resolution of the stage deadlines
+		static constexpr int TIMER_RESOLUTION_MS = 10;
+
+		// Max connections accepted per listener event, the listener is level-triggered so the rest of the backlog is reported again in the next round
+		static constexpr int ACCEPT_BATCH_MAX = 64;
+
 		// Construct the socket manager
-		TCPSocketManager(SocketAddressesFamily _family);
+		TCPSocketManager(SocketAddressesFamily _family, int id, SocketPoller::Backend backend = SocketPoller::GetDefaultBackend());
+		~TCPSocketManager();
+
+		static bool SupportsListenerSharding();
+		static bool SupportsDeferAccept();
 
 
 	protected:
+		int m_id;
+
+		// Readiness backend (epoll on Linux, WSAPoll/poll elsewhere), declared first so it outlives the sockets registered in it
+		std::unique_ptr<SocketPoller>		m_poller;
+		std::vector<SocketPoller::Event>	m_events;	// ready events filled by m_poller->Wait()
+
 		// Underlying listener socket
 		TCPSocket m_listener;
 
-		// Connections container
-		std::vector<std::shared_ptr<AuthSession>> m_list;
-		
-		// m_listener has index 0
-		// m_WakeRead has index 1
-		// Clients go from 2 to n
-		std::vector<pollfd> m_poll_fds; 
+		// Connections table, sessions are referred to by handle wherever they may outlive the reference (DB requests, deadlines)
+		SlotMap<std::shared_ptr<AuthSession>>	m_sessions;
 
-		// WakeUp socket loop
-		TCPSocket					m_wakeListen;
+		// Sessions closed during this Poll(), removed from m_sessions (and destroyed) at its end, when no event of this round can refer to them anymore
+		std::vector<SlotHandle>					m_closedSessions;
+
+		// Stage deadlines of the sessions, at most one per session (AuthSession::m_stageTimer). They refer to the session by handle
+		TimerWheel<SlotHandle>		m_timers;
+		size_t						m_handshakesInFlight = 0;
+
+		// When m_handshakesInFlight reaches the server's cap we stop polling the listener, the backlog holds the new clients meanwhile
+		bool						m_listenerPaused = false;
+
+		// Sessions handed back by the HandshakeWorkerPool, a session has at most one step in a worker so it can't hold more than the cap
+		MPSCQueue<AuthSession*>		m_handshakeDone;
+
+		// DB workers deliver here the responses for the requests made by the sessions of this manager
+		DBResponseQueue m_dbResponses;
+
+		// WakeUp channel, lets other threads (the DB workers) interrupt Wait(), so the reactor can block indefinitely
+		// It's an eventfd on Linux, a loopback TCP pair elsewhere (WSAPoll can only wait on sockets)
+#ifdef NECRO_HAS_EVENTFD
+		int							m_wakeFd = -1;
+#else
 		std::unique_ptr<TCPSocket>	m_wakeRead;
-		TCPSocket					m_wakeWrite;
+		std::unique_ptr<TCPSocket>	m_wakeWrite;
+#endif
+		// Set by the first WakeUp() and cleared by the reactor when it handles it, so a burst of WakeUp() costs a single write
+		std::atomic<bool>			m_wakeupPending{ false };
+
+		int  SetupWakeup();
+		void CloseWakeup();
+		void HandleWakeup();
+		void ExecuteDBCallbacks();
 
-		pollfd SetupWakeup();
+		int  HandleListenerEvent(short revents);
+		bool HandleSessionEvent(AuthSession* session, short revents);
+		bool ContinueHandshake(AuthSession* session);
+		bool FinishHandshakeStep(AuthSession* session, int result);
+		void DrainHandshakeCompletions();
+		void UpdateListenerInterest();
+		void CloseSession(AuthSession* session);
+		void RemoveClosedSessions();
+		AuthSession* GetSessionForDBResponse(SlotHandle handle);
+		void ExpireTimers();
+		void OnStageTimeout(SlotHandle handle);
+		int  GetWaitTimeout(int maxTimeout);
 
 	public:
 		int Poll();
 		void WakeUp();
 
+		// Called by a HandshakeWorkerPool thread
+		void CompleteOffloadedHandshake(AuthSession* session);
+
+		void EnterStage(AuthSession* session, SocketStatus status);
+		static int GetStageTimeoutMs(SocketStatus status);
+
+		//-----------------------------------------------------------------------------------------------------
+		// Returns the session of handle, nullptr if it has been closed
+		//-----------------------------------------------------------------------------------------------------
+		AuthSession* GetSession(SlotHandle handle)
+		{
+			std::shared_ptr<AuthSession>* session = m_sessions.Get(handle);
+
+			if (!session || (*session)->m_status == SocketStatus::CLOSED)
+				return nullptr;
+
+			return session->get();
+		}
+
+		//-----------------------------------------------------------------------------------------------------
+		// Runs the callback of a DB response, f(AuthSession*), if its session is still there.
+		// The session is closed if f returns false (like the packet handlers)
+		//-----------------------------------------------------------------------------------------------------
+		template<typename F>
+		bool DispatchDBCallback(SlotHandle handle, F&& f)
+		{
+			AuthSession* session = GetSessionForDBResponse(handle);
+
+			if (!session)
+				return false;
+
+			if (!f(session) || !session->IsOpen())
+			{
+				CloseSession(session);
+				return false;
+			}
+
+			return true;
+		}
+
+		size_t GetHandshakesInFlight() const
+		{
+			return m_handshakesInFlight;
+		}
+
+		size_t GetSessionsCount() const
+		{
+			return m_sessions.Size();
+		}
+
+		int GetID() const
+		{
+			return m_id;
+		}
+
+		SocketPoller::Backend GetPollerBackend() const
+		{
+			return m_poller->GetBackend();
+		}
+
+		DBResponseQueue& GetDBResponseQueue()
+		{
+			return m_dbResponses;
+		}
+
 	};
 
 }
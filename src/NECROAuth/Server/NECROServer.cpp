@@ -38,6 +38,19 @@ namespace Auth
 
 		SocketUtility::Initialize();
 
+		// Without the shared cache sessions can only be resumed on this process
+		if (!m_tlsSessionCacheName.empty())
+		{
+			if (m_tlsSessionCache.Open(m_tlsSessionCacheName) == 0)
+				OpenSSLManager::SetExternalSessionCache(&m_tlsSessionCache);
+			else
+			{
+				LOG_WARNING("Could not open the shared TLS session cache {}, TLS sessions will only be resumed by this process.", m_tlsSessionCacheName);
+			}
+		}
+
+		OpenSSLManager::SetKTLSEnabled(m_ktlsEnabled);
+
 		if (OpenSSLManager::ServerInit() != 0)
 			return -1;
 
@@ -47,20 +60,54 @@ namespace Auth
 			return -2;
 		}
 
-		if (m_dbworker.Setup(Database::DBType::LOGIN_DATABASE) != 0)
+		int dbWorkers = m_dbWorkersCount > 0 ? m_dbWorkersCount : DEFAULT_DB_WORKERS;
+
+		if (m_dbworkerPool.Setup(Database::DBType::LOGIN_DATABASE, static_cast<size_t>(dbWorkers)) != 0)
 		{
-			LOG_ERROR("Could not initialize directdb, MySQL may be not running.");
+			LOG_ERROR("Could not initialize the dbworker pool, MySQL may be not running.");
 			return -3;
 		}
 
-		if (m_dbworker.Start() != 0)
+		if (m_dbworkerPool.Start() != 0)
 		{
-			LOG_ERROR("Could not start dbworker, MySQL may be not running.");
+			LOG_ERROR("Could not start the dbworker pool, MySQL may be not running.");
 			return -4;
 		}
 
-		// Make TCPSocketManager
-		m_sockManager = std::make_unique<TCPSocketManager>(SocketAddressesFamily::INET);
+		LOG_OK("NECROAuth will run {} database worker(s).", dbWorkers);
+
+		if (m_handshakeThreadsCount > 0)
+		{
+			m_handshakePool.Start(static_cast<size_t>(m_handshakeThreadsCount));
+			LOG_OK("NECROAuth will run the TLS handshakes on {} thread(s), at most {} in flight per reactor.", m_handshakeThreadsCount, m_maxHandshakes);
+		}
+		else
+		{
+			LOG_OK("NECROAuth will run the TLS handshakes on the reactors, at most {} in flight per reactor.", m_maxHandshakes);
+		}
+
+		// Make the TCPSocketManagers, one per I/O thread
+		int ioThreads = m_ioThreadsCount > 0 ? m_ioThreadsCount : static_cast<int>(std::thread::hardware_concurrency());
+		if (ioThreads <= 0)
+			ioThreads = 1;
+
+		if (ioThreads > 1 && !TCPSocketManager::SupportsListenerSharding())
+		{
+			LOG_WARNING("SO_REUSEPORT is not available on this platform, NECROAuth will run with a single I/O thread instead of {}.", ioThreads);
+			ioThreads = 1;
+		}
+
+		if (m_deferAcceptSeconds > 0 && !TCPSocketManager::SupportsDeferAccept())
+		{
+			LOG_WARNING("TCP_DEFER_ACCEPT is not available on this platform, the reactors will be woken up as soon as a connection is established.");
+			m_deferAcceptSeconds = 0;
+		}
+
+		for (int i = 0; i < ioThreads; i++)
+			m_sockManagers.push_back(std::make_unique<TCPSocketManager>(SocketAddressesFamily::INET, i, m_pollerBackend));
+
+		// The reactors may have fallen back to another backend if the requested one is not usable
+		LOG_OK("NECROAuth will run {} I/O thread(s) ({}).", ioThreads, SocketPoller::GetBackendName(m_sockManagers[0]->GetPollerBackend()));
 
 		return 0;
 	}
@@ -73,17 +120,32 @@ namespace Auth
 	}
 
 	void Server::Update()
+	{
+		// Every reactor runs its loop on its own thread
+		for (auto& manager : m_sockManagers)
+			m_ioThreads.emplace_back(&Server::IORoutine, this, manager.get());
+
+		for (std::thread& t : m_ioThreads)
+			t.join();
+
+		m_ioThreads.clear();
+
+		Shutdown();
+	}
+
+	void Server::IORoutine(TCPSocketManager* manager)
 	{
 		// Server Loop
 		while (m_isRunning)
 		{
-			int pollVal = m_sockManager->Poll();
+			int pollVal = manager->Poll();
 
 			if (pollVal == -1)
+			{
+				LOG_ERROR("Reactor {} failed.", manager->GetID());
 				Stop();
+			}
 		}
-
-		Shutdown();
 	}
 
 	void Server::Stop()
@@ -91,6 +153,10 @@ namespace Auth
 		LOG_OK("Stopping NECROAuth...");
 
 		m_isRunning = false;
+
+		// Reactors block until something happens, make sure they see we're stopping
+		for (auto& manager : m_sockManagers)
+			manager->WakeUp();
 	}
 
 	int Server::Shutdown()
@@ -100,9 +166,15 @@ namespace Auth
 
 		m_directdb.Close();
 
-		m_dbworker.Stop();
-		m_dbworker.Join();
-		m_dbworker.CloseDB();
+		m_handshakePool.Stop();
+
+		m_dbworkerPool.Stop();
+		m_dbworkerPool.Join();
+		m_dbworkerPool.LogStats();
+		m_accountCache.LogStats();
+		BufferPool::LogStats();
+		OpenSSLManager::LogHandshakeStats();
+		m_dbworkerPool.CloseDB();
 
 		LOG_OK("Shut down of the NECROAuth completed.");
 		return 0;
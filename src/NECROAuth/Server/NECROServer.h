@@ -4,9 +4,17 @@
 #include "ConsoleLogger.h"
 #include "FileLogger.h"
 #include "TCPSocketManager.h"
+#include "AccountCache.h"
+#include "SharedMemorySessionCache.h"
 
 #include "LoginDatabase.h"
-#include "DatabaseWorker.h"
+#include "DatabaseWorkerPool.h"
+#include "HandshakeWorkerPool.h"
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
 
 namespace NECRO
 {
@@ -16,37 +24,93 @@ namespace Auth
 	constexpr uint8_t CLIENT_VERSION_MINOR = 0;
 	constexpr uint8_t CLIENT_VERSION_REVISION = 0;
 
+	// 0 means one I/O thread (reactor) per hardware thread
+	constexpr int DEFAULT_IO_THREADS = 0;
+
+	// Number of DatabaseWorkers (each one with its own MySQL session)
+	constexpr int DEFAULT_DB_WORKERS = 4;
+
+	// Threads running the TLS handshakes for the reactors, 0 means every reactor runs its own handshakes
+	constexpr int DEFAULT_HANDSHAKE_THREADS = 0;
+
+	// Max TLS handshakes in flight per reactor, further connections wait in the listen backlog
+	constexpr size_t DEFAULT_MAX_HANDSHAKES = 256;
+
+	// Seconds a connection can stay in the backlog waiting for its ClientHello (TCP_DEFER_ACCEPT), 0 wakes up the reactor as soon as it's established
+	constexpr int DEFAULT_DEFER_ACCEPT_SECONDS = 0;
+
 	class Server
 	{
 	public:
 		Server() :
-			m_isRunning(false)
+			m_isRunning(false),
+			m_ioThreadsCount(DEFAULT_IO_THREADS),
+			m_pollerBackend(SocketPoller::GetDefaultBackend()),
+			m_dbWorkersCount(DEFAULT_DB_WORKERS),
+			m_handshakeThreadsCount(DEFAULT_HANDSHAKE_THREADS),
+			m_maxHandshakes(DEFAULT_MAX_HANDSHAKES),
+			m_deferAcceptSeconds(DEFAULT_DEFER_ACCEPT_SECONDS)
 		{
 
 		}
 
 	private:
 		// Status
-		bool m_isRunning;
+		std::atomic<bool> m_isRunning;
 
 		ConsoleLogger	m_cLogger;
 		FileLogger		m_fLogger;
 
-		std::unique_ptr<TCPSocketManager> m_sockManager;
+		// One TCPSocketManager (reactor) per I/O thread
+		int												m_ioThreadsCount;
+		SocketPoller::Backend							m_pollerBackend;
+		std::vector<std::unique_ptr<TCPSocketManager>>	m_sockManagers;
+		std::vector<std::thread>						m_ioThreads;
+
+		// directdb runs (and blocks) on the calling thread, it must never be used by the reactors: a query there would stall every client of the reactor.
+		// Queries made while handling packets go through the dbworker pool with a callback (or "fire-and-forget" for logs, fields, etc)
+		LoginDatabase		m_directdb;
+		int					m_dbWorkersCount;
+		DatabaseWorkerPool	m_dbworkerPool;
 
-		// directdb will be used for queries that run (and block) on the main thread
-		// to use only with data-critical code, for example, while making a response packet where an information in the database is needed to go further
-		// for "fire-and-forget" operations like updating logs, fields, etc we can use the dbworker
-		LoginDatabase	m_directdb;
-		DatabaseWorker	m_dbworker;
+		// username -> accountID, shared by the reactors
+		AccountCache		m_accountCache;
+
+		int					m_handshakeThreadsCount;
+		size_t				m_maxHandshakes;
+		int					m_deferAcceptSeconds;
+		HandshakeWorkerPool	m_handshakePool;
+
+		// TLS sessions shared with the other NECROAuth processes of this host, enabled when a name is set
+		std::string					m_tlsSessionCacheName;
+		SharedMemorySessionCache	m_tlsSessionCache;
+
+		// Hand the TLS record layer to the kernel after the handshake, where it supports it
+		bool						m_ktlsEnabled = false;
+
+		void					IORoutine(TCPSocketManager* manager);
 
 	public:
 		ConsoleLogger&		GetConsoleLogger();
 		FileLogger&			GetFileLogger();
-		TCPSocketManager&	GetSocketManager();
-
-		LoginDatabase&	GetDirectDB();
-		DatabaseWorker&	GetDBWorker();
+		TCPSocketManager&	GetSocketManager(int id);
+		size_t				GetSocketManagersCount() const;
+
+		LoginDatabase&		GetDirectDB();
+		DatabaseWorkerPool&	GetDBWorkerPool();
+		AccountCache&		GetAccountCache();
+		HandshakeWorkerPool&	GetHandshakePool();
+		size_t				GetMaxHandshakes() const;
+		int					GetDeferAcceptSeconds() const;
+
+		void					SetIOThreadsCount(int count);
+		void					SetPollerBackend(SocketPoller::Backend backend);
+		void					SetDBWorkersCount(int count);
+		void					SetTLSSessionCacheName(const std::string& name);
+		void					SetKTLSEnabled(bool enabled);
+		void					SetHandshakeThreadsCount(int count);
+		void					SetMaxHandshakes(size_t count);
+		void					SetDeferAcceptSeconds(int seconds);
 
 		int						Init();
 		void					Start();
@@ -69,9 +133,14 @@ namespace Auth
 		return m_fLogger;
 	}
 
-	inline TCPSocketManager& Server::GetSocketManager()
+	inline TCPSocketManager& Server::GetSocketManager(int id)
+	{
+		return *m_sockManagers[id].get();
+	}
+
+	inline size_t Server::GetSocketManagersCount() const
 	{
-		return *m_sockManager.get();
+		return m_sockManagers.size();
 	}
 
 	inline LoginDatabase& Server::GetDirectDB()
@@ -79,9 +148,69 @@ namespace Auth
 		return m_directdb;
 	}
 
-	inline DatabaseWorker& Server::GetDBWorker()
+	inline void Server::SetIOThreadsCount(int count)
+	{
+		m_ioThreadsCount = count;
+	}
+
+	inline void Server::SetPollerBackend(SocketPoller::Backend backend)
+	{
+		m_pollerBackend = backend;
+	}
+
+	inline void Server::SetDBWorkersCount(int count)
+	{
+		m_dbWorkersCount = count;
+	}
+
+	inline void Server::SetTLSSessionCacheName(const std::string& name)
+	{
+		m_tlsSessionCacheName = name;
+	}
+
+	inline void Server::SetKTLSEnabled(bool enabled)
+	{
+		m_ktlsEnabled = enabled;
+	}
+
+	inline DatabaseWorkerPool& Server::GetDBWorkerPool()
+	{
+		return m_dbworkerPool;
+	}
+
+	inline AccountCache& Server::GetAccountCache()
+	{
+		return m_accountCache;
+	}
+
+	inline HandshakeWorkerPool& Server::GetHandshakePool()
+	{
+		return m_handshakePool;
+	}
+
+	inline size_t Server::GetMaxHandshakes() const
+	{
+		return m_maxHandshakes;
+	}
+
+	inline void Server::SetHandshakeThreadsCount(int count)
+	{
+		m_handshakeThreadsCount = count;
+	}
+
+	inline void Server::SetMaxHandshakes(size_t count)
+	{
+		m_maxHandshakes = count > 0 ? count : DEFAULT_MAX_HANDSHAKES;
+	}
+
+	inline int Server::GetDeferAcceptSeconds() const
+	{
+		return m_deferAcceptSeconds;
+	}
+
+	inline void Server::SetDeferAcceptSeconds(int seconds)
 	{
-		return m_dbworker;
+		m_deferAcceptSeconds = seconds > 0 ? seconds : 0;
 	}
 }
 }
@@ -2,8 +2,123 @@
 
 #include "NECROServer.h"
 
-int main()
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <string>
+
+using namespace NECRO;
+
+//-----------------------------------------------------------------------------------------------------
+// Parses the integer that follows the prefix of arg. Logs it and returns false if it's not a number or doesn't fit in an int
+//-----------------------------------------------------------------------------------------------------
+static bool ParseIntArg(const std::string& arg, size_t prefixLen, int& out)
 {
+	const char* value = arg.c_str() + prefixLen;
+	char* end = nullptr;
+
+	errno = 0;
+	long v = std::strtol(value, &end, 10);
+
+	if (end == value || *end != '\0' || errno == ERANGE || v < INT_MIN || v > INT_MAX)
+	{
+		LOG_ERROR("Invalid argument {}, expected an integer.", arg);
+		return false;
+	}
+
+	out = static_cast<int>(v);
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	// --io-threads=N sets the number of reactors, the default is one per hardware thread
+	// --poller=poll|epoll selects the readiness backend of the reactors, the default is epoll on Linux and poll elsewhere
+	// --db-workers=N sets the number of database workers (MySQL sessions)
+	// --handshake-threads=N runs the TLS handshakes on N threads instead of on the reactors
+	// --max-handshakes=N caps the TLS handshakes in flight per reactor
+	// --defer-accept=SECONDS holds new connections in the backlog until their ClientHello arrives (at most SECONDS)
+	// --ktls offloads the TLS record encryption to the kernel after the handshake, where it's supported
+	// --tls-session-cache=NAME shares the TLS sessions with the other NECROAuth processes of this host started with the same NAME
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg(argv[i]);
+		const std::string ioThreadsArg = "--io-threads=";
+		const std::string pollerArg = "--poller=";
+		const std::string dbWorkersArg = "--db-workers=";
+		const std::string tlsSessionCacheArg = "--tls-session-cache=";
+		const std::string handshakeThreadsArg = "--handshake-threads=";
+		const std::string maxHandshakesArg = "--max-handshakes=";
+		const std::string deferAcceptArg = "--defer-accept=";
+		const std::string ktlsArg = "--ktls";
+
+		if (arg.rfind(ioThreadsArg, 0) == 0)
+		{
+			int count;
+			if (!ParseIntArg(arg, ioThreadsArg.size(), count))
+				return 1;
+
+			NECRO::Auth::g_server.SetIOThreadsCount(count);
+		}
+		else if (arg.rfind(pollerArg, 0) == 0)
+		{
+			std::string name = arg.substr(pollerArg.size());
+
+			if (name == "poll")
+				NECRO::Auth::g_server.SetPollerBackend(NECRO::SocketPoller::Backend::POLL);
+			else if (name == "epoll")
+				NECRO::Auth::g_server.SetPollerBackend(NECRO::SocketPoller::Backend::EPOLL);
+			else
+			{
+				LOG_ERROR("Invalid argument {}, expected poll or epoll.", arg);
+				return 1;
+			}
+		}
+		else if (arg.rfind(dbWorkersArg, 0) == 0)
+		{
+			int count;
+			if (!ParseIntArg(arg, dbWorkersArg.size(), count))
+				return 1;
+
+			NECRO::Auth::g_server.SetDBWorkersCount(count);
+		}
+		else if (arg.rfind(tlsSessionCacheArg, 0) == 0)
+			NECRO::Auth::g_server.SetTLSSessionCacheName(arg.substr(tlsSessionCacheArg.size()));
+		else if (arg.rfind(handshakeThreadsArg, 0) == 0)
+		{
+			int count;
+			if (!ParseIntArg(arg, handshakeThreadsArg.size(), count))
+				return 1;
+
+			NECRO::Auth::g_server.SetHandshakeThreadsCount(count);
+		}
+		else if (arg.rfind(maxHandshakesArg, 0) == 0)
+		{
+			int count;
+			if (!ParseIntArg(arg, maxHandshakesArg.size(), count))
+				return 1;
+
+			// A negative cap would wrap around to a huge size_t
+			if (count < 0)
+			{
+				LOG_ERROR("Invalid argument {}, expected a non-negative integer.", arg);
+				return 1;
+			}
+
+			NECRO::Auth::g_server.SetMaxHandshakes(static_cast<size_t>(count));
+		}
+		else if (arg == ktlsArg)
+			NECRO::Auth::g_server.SetKTLSEnabled(true);
+		else if (arg.rfind(deferAcceptArg, 0) == 0)
+		{
+			int seconds;
+			if (!ParseIntArg(arg, deferAcceptArg.size(), seconds))
+				return 1;
+
+			NECRO::Auth::g_server.SetDeferAcceptSeconds(seconds);
+		}
+	}
+
 	if (NECRO::Auth::g_server.Init() == 0)
 	{
 		NECRO::Auth::g_server.Start();
@@ -21,6 +21,8 @@ namespace Client
 		std::array<uint8_t, AES_128_KEY_SIZE> sessionKey;
 		std::array<uint8_t, AES_128_KEY_SIZE> greetcode;
 
+		AES::SessionCipher cipher; // keyed with sessionKey once received
+
 		AES::IV iv;
 
 		bool hasAuthenticated = false;
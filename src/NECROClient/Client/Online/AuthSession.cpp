@@ -60,7 +60,7 @@ namespace Client
         greetPacket << usernameLenght;
         greetPacket << netManager.GetData().username; // string is and should be without null terminator!
 
-        NetworkMessage message(greetPacket);
+        NetworkMessage message(std::move(greetPacket));
         QueuePacket(std::move(message));
         //Send(); packets are sent by checking POLLOUT events in the socket, and we check for POLLOUT events only if there are packets written in the outQueue
     }
@@ -69,7 +69,7 @@ namespace Client
     {
         LOG_OK("AuthSession ReadCallback");
 
-        NetworkMessage& packet = m_inBuffer;
+        RecvBuffer& packet = m_inBuffer;
 
         while (packet.GetActiveSize())
         {
@@ -134,7 +134,7 @@ namespace Client
     bool AuthSession::HandlePacketAuthLoginGatherInfoResponse()
     {
         Console& c = engine.GetConsole();
-        NECRO::Auth::CPacketAuthLoginGatherInfo* pckData = reinterpret_cast<NECRO::Auth::CPacketAuthLoginGatherInfo*>(m_inBuffer.GetBasePointer());
+        NECRO::Auth::CPacketAuthLoginGatherInfo* pckData = reinterpret_cast<NECRO::Auth::CPacketAuthLoginGatherInfo*>(m_inBuffer.GetReadPointer());
         AuthManager& net = engine.GetAuthManager();
 
         if (pckData->error == static_cast<int>(NECRO::Auth::AuthResults::SUCCESS))
@@ -166,7 +166,7 @@ namespace Client
 
             std::cout << "My IV Prefix: " << net.GetData().iv.prefix << std::endl;
 
-            NetworkMessage m(packet);
+            NetworkMessage m(std::move(packet));
             QueuePacket(std::move(m));
             //Send(); packets are sent by checking POLLOUT events in the socket, and we check for POLLOUT events only if there are packets written in the outQueue
 
@@ -204,7 +204,7 @@ namespace Client
         AuthManager& netManager = engine.GetAuthManager();
 
         Console& c = engine.GetConsole();
-        NECRO::Auth::CPacketAuthLoginProof* pckData = reinterpret_cast<NECRO::Auth::CPacketAuthLoginProof*>(m_inBuffer.GetBasePointer());
+        NECRO::Auth::CPacketAuthLoginProof* pckData = reinterpret_cast<NECRO::Auth::CPacketAuthLoginProof*>(m_inBuffer.GetReadPointer());
 
         if (pckData->error == static_cast<int>(NECRO::Auth::LoginProofResults::SUCCESS))
         {
@@ -215,6 +215,10 @@ namespace Client
             // Save the session key in the netManager data
             std::copy(std::begin(pckData->sessionKey), std::end(pckData->sessionKey), std::begin(netManager.GetData().sessionKey));
 
+            // Key the session cipher once, every encrypted message will only set its IV
+            if (netManager.GetData().cipher.SetKey(netManager.GetData().sessionKey.data()) != 0)
+                c.Log("Could not set up the session cipher.");
+
             // Convert sessionKey to hex string in order to print it
             std::ostringstream sessionStrStream;
             for (int i = 0; i < AES_128_KEY_SIZE; ++i)
@@ -47,8 +47,30 @@ namespace NECRO
             return -4;
         }
 
+        //-------------------------------------------------------
+        // Sends a trivial query to check if the session is still usable
+        //-------------------------------------------------------
+        bool IsAlive()
+        {
+            if (!m_session)
+                return false;
+
+            try
+            {
+                m_session->sql("SELECT 1;").execute();
+                return true;
+            }
+            catch (...)
+            {
+                return false;
+            }
+        }
+
         void Close()
         {
+            if (!m_session)
+                return;
+
             try
             {
                 m_session->close();
@@ -65,6 +87,8 @@ namespace NECRO
             {
                 LOG_INFO(std::string("DBConnection Close Error: Unknown exception during session initialization."));
             }
+
+            m_session.reset();
         }
     };
 
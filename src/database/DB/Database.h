@@ -1,6 +1,11 @@
 #ifndef NECRO_DATABASE_H
 #define NECRO_DATABASE_H
 
+#include <vector>
+#include <memory>
+#include <string>
+#include <stdexcept>
+
 #include "DBConnection.h"
 
 namespace NECRO
@@ -20,12 +25,124 @@ namespace NECRO
 	protected:
 		DBConnection m_conn;
 
+		// SQL text of the statements, indexed by the statements enum of the derived class, empty for the ones that are not implemented.
+		// Only the text is kept: a mysqlx::SqlStatement can't be reused, bind() appends to its parameters and nothing clears them
+		std::vector<std::string> m_statements;
+
+		//-----------------------------------------------------------------------------------------------------
+		// Fills the statements cache, the text doesn't depend on the session so this is only needed once
+		//-----------------------------------------------------------------------------------------------------
+		void LoadStatements()
+		{
+			m_statements.clear();
+			m_statements.resize(GetStatementsCount());
+
+			for (int i = 0; i < GetStatementsCount(); i++)
+			{
+				const char* sql = GetStatementSQL(i);
+
+				if (sql)
+					m_statements[i] = sql;
+			}
+		}
+
 
 	public:
+		virtual ~Database() = default;
+
 		virtual int Init() = 0;
-		virtual mysqlx::SqlStatement Prepare(int enum_val) = 0;
 		virtual mysqlx::SqlResult Execute(mysqlx::SqlStatement& statement) = 0;
 		virtual int Close() = 0;
+
+		// SQL text of each statement, nullptr for the ones that are not implemented
+		virtual const char* GetStatementSQL(int enum_val) const = 0;
+		virtual int GetStatementsCount() const = 0;
+
+		// True for "INSERT ... VALUES (?, ...);" statements whose consecutive executions can be merged in a single multi-row INSERT
+		virtual bool IsMultiRowInsert(int enum_val) const { return false; }
+
+		//-----------------------------------------------------------------------------------------------------
+		// Builds the text of a multi-row version of the statement, repeating its VALUES tuple 'rows' times
+		//-----------------------------------------------------------------------------------------------------
+		std::string BuildMultiRowInsertSQL(int enum_val, size_t rows) const
+		{
+			std::string sql(GetStatementSQL(enum_val));
+
+			size_t valuesPos = sql.find("VALUES ");
+			if (valuesPos == std::string::npos)
+				throw std::invalid_argument("Not an INSERT ... VALUES statement");
+
+			size_t tupleStart = valuesPos + 7;
+			size_t tupleEnd = sql.rfind(')') + 1;
+			std::string tuple = sql.substr(tupleStart, tupleEnd - tupleStart);
+
+			std::string res = sql.substr(0, tupleStart);
+			res.reserve(res.size() + rows * (tuple.size() + 2));
+
+			for (size_t i = 0; i < rows; i++)
+			{
+				if (i > 0)
+					res += ", ";
+				res += tuple;
+			}
+
+			res += ";";
+			return res;
+		}
+
+		mysqlx::SqlStatement MakeStatement(const std::string& sql)
+		{
+			return m_conn.m_session->sql(sql);
+		}
+
+		void StartTransaction()
+		{
+			m_conn.m_session->startTransaction();
+		}
+
+		void Commit()
+		{
+			m_conn.m_session->commit();
+		}
+
+		void Rollback()
+		{
+			try
+			{
+				m_conn.m_session->rollback();
+			}
+			catch (...)
+			{
+				// The session may be gone already, nothing to roll back then
+			}
+		}
+
+		//-----------------------------------------------------------------------------------------------------
+		// Returns a new statement for the cached text, ready to be bound with parameters and executed by the caller.
+		// Every execution needs its own statement (see m_statements). Must only be used by the thread that owns the Database
+		//-----------------------------------------------------------------------------------------------------
+		mysqlx::SqlStatement GetStatement(int enum_val)
+		{
+			if (enum_val < 0 || enum_val >= static_cast<int>(m_statements.size()) || m_statements[enum_val].empty())
+				throw std::invalid_argument("Invalid or not implemented statement");
+
+			return m_conn.m_session->sql(m_statements[enum_val]);
+		}
+
+		//-----------------------------------------------------------------------------------------------------
+		// Drops the current session and opens a new one
+		//-----------------------------------------------------------------------------------------------------
+		int Reconnect()
+		{
+			m_conn.Close();
+
+			return Init();
+		}
+
+		bool IsConnected()
+		{
+			return m_conn.IsAlive();
+		}
 	};
 
 }
@@ -16,7 +16,9 @@ namespace NECRO
 		INS_LOG_WRONG_PASSWORD,		// id(uint32_t), username (string), ip:port(string)
 		DEL_PREV_SESSIONS,			// userid(uint32_t)
 		INS_NEW_SESSION,			// userid(uint32_t), sessionKey(binary), authip(string), greetcode(binary)
-		UPD_ON_LOGIN
+		UPD_ON_LOGIN,
+
+		LOGIN_DATABASE_STATEMENTS_COUNT
 	};
 
 
@@ -28,42 +30,55 @@ namespace NECRO
 	public:
 		int Init() override
 		{
-			if (m_conn.Init("localhost", 33060, "root", "root") == 0)
-				return 0;
-			else
+			if (m_conn.Init("localhost", 33060, "root", "root") != 0)
 				return -1;
+
+			if (m_statements.empty())
+				LoadStatements();
+
+			return 0;
+		}
+
+		int GetStatementsCount() const override
+		{
+			return static_cast<int>(LoginDatabaseStatements::LOGIN_DATABASE_STATEMENTS_COUNT);
+		}
+
+		bool IsMultiRowInsert(int enum_value) const override
+		{
+			return enum_value == static_cast<int>(LoginDatabaseStatements::INS_LOG_WRONG_PASSWORD) ||
+				   enum_value == static_cast<int>(LoginDatabaseStatements::INS_NEW_SESSION);
 		}
 
 
 		//-----------------------------------------------------------------------------------------------------
-		// Returns a mysqlx::SqlStatement, ready to be bound with parameters and executed by the caller
+		// Returns the SQL text of the statement, used to fill the statements cache
 		//-----------------------------------------------------------------------------------------------------
-		mysqlx::SqlStatement Prepare(int enum_value) override
+		const char* GetStatementSQL(int enum_value) const override
 		{
 			switch (enum_value)
 			{
 			case static_cast<int>(LoginDatabaseStatements::SEL_ACCOUNT_ID_BY_NAME):
-				return m_conn.m_session->sql("SELECT id FROM necroauth.users WHERE username = ?;");
+				return "SELECT id FROM necroauth.users WHERE username = ?;";
 				
 			case static_cast<int>(LoginDatabaseStatements::CHECK_PASSWORD):
-				return m_conn.m_session->sql("SELECT password FROM necroauth.users WHERE id = ?;"); // TODO password should not be in clear, but should be hashed and salted with the salt saved for each user
+				return "SELECT password FROM necroauth.users WHERE id = ?;"; // TODO password should not be in clear, but should be hashed and salted with the salt saved for each user
 
 			case static_cast<int>(LoginDatabaseStatements::INS_LOG_WRONG_PASSWORD):
-				return m_conn.m_session->sql("INSERT INTO necroauth.logs_actions (ip, username, action) VALUES (?, ?, ?);");
+				return "INSERT INTO necroauth.logs_actions (ip, username, action) VALUES (?, ?, ?);";
 
 			case static_cast<int>(LoginDatabaseStatements::DEL_PREV_SESSIONS):
-				return m_conn.m_session->sql("DELETE FROM necroauth.active_sessions WHERE userid = ?;");
+				return "DELETE FROM necroauth.active_sessions WHERE userid = ?;";
 
 			case static_cast<int>(LoginDatabaseStatements::INS_NEW_SESSION):
-				return m_conn.m_session->sql("INSERT INTO necroauth.active_sessions (userid, sessionkey, authip, greetcode) VALUES (?, ?, ?, ?);");
+				return "INSERT INTO necroauth.active_sessions (userid, sessionkey, authip, greetcode) VALUES (?, ?, ?, ?);";
 
 			case static_cast<int>(LoginDatabaseStatements::UPD_ON_LOGIN):
 				// TODO
-				break;
+				return nullptr;
 
 			default:
 				throw std::invalid_argument("Invalid LoginDatabaseStatement");
-				break;
 			}
 		}
 
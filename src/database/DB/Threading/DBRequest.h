@@ -4,27 +4,56 @@
 #include <cstdint>
 #include <memory>
 #include <functional> 
+#include <vector>
+#include <chrono>
 
 #include <mysqlx/xdevapi.h>
 
+namespace NECRO
+{
+	class DBResponseQueue;
+}
+
 class DBRequest
 {
 public:
 	bool									m_done = false;
 	bool									m_fireAndForget;
-	mysqlx::SqlStatement					m_sqlStmt;
+
+	// The statement is prepared and bound by the worker thread, on its own session, the caller only specifies which statement and the values to bind
+	int										m_stmtID;
+	std::vector<mysqlx::Value>				m_params;
+
 	std::vector<uint8_t>					m_pcktData;
 	mysqlx::SqlResult						m_sqlRes;
-	std::function<bool(mysqlx::SqlResult&)>	m_callback;
 
+	// Set by the worker when the statement could not be executed. The response is delivered anyway, and the callback gets nullptr instead of the result
+	bool									m_failed = false;
+	std::function<bool(mysqlx::SqlResult*)>	m_callback;
+
+	// Where the worker delivers the request once executed (if it needs a callback), it's owned by the reactor that will run the callback
+	NECRO::DBResponseQueue*					m_respQueue = nullptr;
 	std::function<void()>					m_noticeFunc;
 
+	// Set by the worker when the request is enqueued, used to measure the latency of the worker
+	std::chrono::steady_clock::time_point	m_enqueueTime;
 
-	DBRequest(bool fireAndForget, mysqlx::SqlStatement stmt) : m_fireAndForget(fireAndForget), m_sqlStmt(std::move(stmt))
+
+	DBRequest(bool fireAndForget, int stmtID) : m_fireAndForget(fireAndForget), m_stmtID(stmtID)
 	{
 		m_done = false;
 		m_callback = nullptr;
 	}
+
+	//-----------------------------------------------------------------------------------------------------
+	// Adds a value to bind to the next '?' of the statement
+	//-----------------------------------------------------------------------------------------------------
+	template<typename T>
+	DBRequest& Bind(T&& value)
+	{
+		m_params.emplace_back(std::forward<T>(value));
+		return *this;
+	}
 };
 
 #endif
@@ -0,0 +1,73 @@
+#ifndef NECRO_DB_RESPONSE_QUEUE_H
+#define NECRO_DB_RESPONSE_QUEUE_H
+
+#include <vector>
+#include <memory>
+
+#include "DBRequest.h"
+#include "SPSCRing.h"
+
+namespace NECRO
+{
+	//-----------------------------------------------------------------------------------------------------
+	// Queue of executed DBRequests waiting for their callback to be run.
+	// Every reactor owns one, so the callbacks run on the thread that owns the session that made the request.
+	// It's made of one SPSC ring per DB worker, so neither the workers nor the reactor ever take a lock
+	//-----------------------------------------------------------------------------------------------------
+	class DBResponseQueue
+	{
+	public:
+		static constexpr size_t DEFAULT_RING_CAPACITY = 1024;
+
+	private:
+		std::vector<std::unique_ptr<SPSCRing<DBRequest>>> m_rings;	// indexed by the worker index
+
+	public:
+		//-----------------------------------------------------------------------------------------------------
+		// Must be called before any worker can deliver here
+		//-----------------------------------------------------------------------------------------------------
+		void Setup(size_t workersCount, size_t ringCapacity = DEFAULT_RING_CAPACITY)
+		{
+			m_rings.clear();
+
+			for (size_t i = 0; i < workersCount; i++)
+				m_rings.push_back(std::make_unique<SPSCRing<DBRequest>>(ringCapacity));
+		}
+
+		//-----------------------------------------------------------------------------------------------------
+		// Called by the DB worker 'workerIndex' only. Returns false if its ring is full
+		//-----------------------------------------------------------------------------------------------------
+		bool Push(size_t workerIndex, DBRequest&& r)
+		{
+			return m_rings[workerIndex]->TryPush(std::move(r));
+		}
+
+		//-----------------------------------------------------------------------------------------------------
+		// Called by the owning reactor, runs f on everything that's been delivered so far
+		//-----------------------------------------------------------------------------------------------------
+		template<typename F>
+		size_t Drain(F&& f)
+		{
+			size_t count = 0;
+
+			for (auto& ring : m_rings)
+				count += ring->Drain(f);
+
+			return count;
+		}
+
+		size_t GetHighWaterMark() const
+		{
+			size_t hwm = 0;
+
+			for (auto& ring : m_rings)
+				if (ring->GetHighWaterMark() > hwm)
+					hwm = ring->GetHighWaterMark();
+
+			return hwm;
+		}
+	};
+
+}
+
+#endif
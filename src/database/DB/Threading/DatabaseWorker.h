@@ -4,12 +4,17 @@
 #include <thread>
 #include <mutex>
 #include <condition_variable>
-#include <queue>
 #include <memory>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <vector>
 
 #include "LoginDatabase.h"
 #include "DBRequest.h"
-#include <windows.h>
+#include "DBResponseQueue.h"
+#include "MPSCQueue.h"
+
 namespace NECRO
 {
 	//-----------------------------------------------------------------------------------------------------
@@ -17,27 +22,67 @@ namespace NECRO
 	//-----------------------------------------------------------------------------------------------------
 	class DatabaseWorker
 	{
+	public:
+		// Fire-and-forget requests are flushed in batches (one transaction each) of up to BATCH_MAX_REQUESTS,
+		// waiting at most BATCH_WINDOW_MS for the batch to fill up when the queue runs dry
+		static constexpr size_t	BATCH_MAX_REQUESTS = 64;
+		static constexpr int	BATCH_WINDOW_MS = 5;
+
+		// Requests queue size, Enqueue() fails when it's full
+		static constexpr size_t	DEFAULT_QUEUE_CAPACITY = 4096;
+
+		struct Stats
+		{
+			size_t		queueDepth;
+			size_t		queueCapacity;
+			size_t		queueHighWaterMark;
+			uint64_t	rejected;		// Enqueue() calls that found the queue full
+			uint64_t	executed;
+			double		avgLatencyMs;	// from Enqueue() to the end of the execution
+			double		maxLatencyMs;
+			uint64_t	batches;		// transactions flushed
+			uint64_t	batchedRequests;// fire-and-forget requests executed in those transactions
+			uint64_t	coalescedRows;	// rows merged in multi-row INSERTs
+		};
+
 	private:
 		std::unique_ptr<Database>	m_db;
 		std::thread					m_thread;
 
 		std::atomic<bool> m_running{ false };
 
-		// !! Shared Members (access with mutex) !!
-		// Queue used to enqueue requests given by the main thread to be executed by this worker thread
-		std::mutex				m_executionMutex;
-		std::condition_variable	m_execWakeupCond;
-		std::queue<DBRequest>	m_execQueue;
-		int						m_execQueueSize = 0;
+		// Position of this worker in its pool, used to pick our ring in the DBResponseQueues
+		size_t m_index;
+
+		// Lock-free queue used to enqueue requests given by the reactors to be executed by this worker thread
+		MPSCQueue<DBRequest>	m_execQueue;
+		std::atomic<uint64_t>	m_rejectedCount{ 0 };
+
+		// Parking spot, only used when the queue is empty: producers take the mutex only if the worker is parked
+		std::mutex				m_parkMutex;
+		std::condition_variable	m_parkCond;
+		std::atomic<bool>		m_parked{ false };
 
-		// !! Shared Members (access with mutex) !!
-		// DBWorker saves Requests that require a callback to be executed upon a SQL Response in the m_respQueue.
-		// DB Worker will insert the request in teh queue and the pooling mechanism of the server will allow the DBThread to wake up the main thread and 
-		// make it check this queue. The callback will be executed on the associated AuthSession object that made the request in the first place.
-		std::mutex				m_respMutex;
-		std::queue<DBRequest>	m_respQueue;
+		// Stats, written by the worker thread and readable from any thread
+		std::atomic<uint64_t>	m_executedCount{ 0 };
+		std::atomic<uint64_t>	m_totalLatencyUs{ 0 };
+		std::atomic<uint64_t>	m_maxLatencyUs{ 0 };
+		std::atomic<uint64_t>	m_batchesCount{ 0 };
+		std::atomic<uint64_t>	m_batchedRequestsCount{ 0 };
+		std::atomic<uint64_t>	m_coalescedRowsCount{ 0 };
+
+		// Requests that require a callback to be executed upon a SQL Response are pushed in the DBResponseQueue they carry (m_respQueue).
+		// Every reactor owns its response queue, so the noticeFunc can wake up the right reactor and make it check its queue. 
+		// The callback will be executed on the associated AuthSession object that made the request in the first place, on the thread that owns it.
 
 	public:
+		DatabaseWorker(size_t index = 0, size_t queueCapacity = DEFAULT_QUEUE_CAPACITY) :
+			m_index(index),
+			m_execQueue(queueCapacity)
+		{
+
+		}
+
 		int Setup(Database::DBType t)
 		{
 			switch (t)
@@ -47,7 +92,7 @@ namespace NECRO
 				break;
 
 			default:
-				throw std::exception("No database type!");
+				throw std::invalid_argument("No database type!");
 			}
 
 			if (m_db->Init() == 0)
@@ -82,12 +127,12 @@ namespace NECRO
 		//-----------------------------------------------------------------------------------------------------
 		void Stop()
 		{
-			{
-				std::lock_guard<std::mutex> lock(m_executionMutex);
+			m_running = false;
 
-				m_running = false;
+			{
+				std::lock_guard<std::mutex> lock(m_parkMutex);
 			}
-			m_execWakeupCond.notify_all();
+			m_parkCond.notify_all();
 		}
 
 		// ----------------------------------------------------------------------------------------------------
@@ -107,96 +152,345 @@ namespace NECRO
 			m_db->Close();
 		}
 
-		void Enqueue(DBRequest&& r)
+		//-----------------------------------------------------------------------------------------------------
+		// Can be called from any thread. Returns false if the queue is full (r is left untouched), the caller
+		// has to fail the operation or retry later
+		//-----------------------------------------------------------------------------------------------------
+		bool Enqueue(DBRequest&& r)
 		{
-			std::lock_guard<std::mutex> lock(m_executionMutex);
-			m_execQueue.push(std::move(r));
-			m_execQueueSize++;
+			r.m_enqueueTime = std::chrono::steady_clock::now();
+
+			if (!m_execQueue.TryPush(std::move(r)))
+			{
+				m_rejectedCount.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
 
-			m_execWakeupCond.notify_all();
+			Unpark();
+			return true;
 		}
 
-		mysqlx::SqlStatement Prepare(int enum_val)
+		//-----------------------------------------------------------------------------------------------------
+		// Back-pressure signal, true when the queue is more than 3/4 full
+		//-----------------------------------------------------------------------------------------------------
+		bool IsUnderPressure() const
 		{
-			return m_db->Prepare(enum_val);
+			return m_execQueue.Size() >= (m_execQueue.Capacity() / 4) * 3;
 		}
 
-		std::queue<DBRequest> GetResponseQueue()
+		Stats GetStats()
 		{
-			std::lock_guard guard(m_respMutex);
+			Stats s;
+
+			s.queueDepth = m_execQueue.Size();
+			s.queueCapacity = m_execQueue.Capacity();
+			s.queueHighWaterMark = m_execQueue.GetHighWaterMark();
+			s.rejected = m_rejectedCount.load(std::memory_order_relaxed);
+
+			s.executed = m_executedCount.load(std::memory_order_relaxed);
+			s.avgLatencyMs = s.executed > 0 ? (m_totalLatencyUs.load(std::memory_order_relaxed) / static_cast<double>(s.executed)) / 1000.0 : 0.0;
+			s.maxLatencyMs = m_maxLatencyUs.load(std::memory_order_relaxed) / 1000.0;
+			s.batches = m_batchesCount.load(std::memory_order_relaxed);
+			s.batchedRequests = m_batchedRequestsCount.load(std::memory_order_relaxed);
+			s.coalescedRows = m_coalescedRowsCount.load(std::memory_order_relaxed);
 
-			std::queue<DBRequest> toReturn;
-			std::swap(toReturn, m_respQueue);
-			return toReturn;
+			return s;
 		}
 
-		void ThreadRoutine()
+		//-----------------------------------------------------------------------------------------------------
+		// Accounts an executed request, called only by the worker thread
+		//-----------------------------------------------------------------------------------------------------
+		void RecordLatency(std::chrono::steady_clock::time_point enqueueTime)
 		{
-			while (true)
+			uint64_t us = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - enqueueTime).count());
+
+			m_executedCount.fetch_add(1, std::memory_order_relaxed);
+			m_totalLatencyUs.fetch_add(us, std::memory_order_relaxed);
+
+			// Only this thread writes the max
+			if (us > m_maxLatencyUs.load(std::memory_order_relaxed))
+				m_maxLatencyUs.store(us, std::memory_order_relaxed);
+		}
+
+		//-----------------------------------------------------------------------------------------------------
+		// Binds and executes the request on a new statement of the cached text.
+		// If the execution fails because the session was lost, reconnects and retries once. Returns 0 on success
+		//-----------------------------------------------------------------------------------------------------
+		int ExecuteRequest(DBRequest& req)
+		{
+			for (int attempt = 0; attempt < 2; attempt++)
 			{
-				std::unique_lock<std::mutex> lock(m_executionMutex);
+				try
+				{
+					mysqlx::SqlStatement stmt = m_db->GetStatement(req.m_stmtID);
+					for (mysqlx::Value& v : req.m_params)
+						stmt.bind(v);
 
-				// If we Stopped the thread and there's nothing in the queue, exit
-				if (!m_running && m_execQueueSize <= 0)
+					req.m_sqlRes = stmt.execute();
+					return 0;
+				}
+				catch (const mysqlx::Error& err)  // catches MySQL Connector/C++ specific exceptions
 				{
-					lock.unlock();
-					break;
+					std::cerr << "DBWorker MySQL error: " << err.what() << std::endl;
+
+					// A failing statement on a working session is not going to succeed the second time
+					if (m_db->IsConnected())
+						return -1;
+
+					LOG_WARNING("DatabaseWorker lost its session, reconnecting...");
+					if (m_db->Reconnect() != 0)
+					{
+						LOG_ERROR("DatabaseWorker could not reconnect, MySQL may be not running.");
+						return -2;
+					}
 				}
+			}
 
-				// Otherwise, we're either still running or there's still something in the queue
-				if (m_execQueueSize <= 0) // if we're still running and queue is empty
+			return -1;
+		}
+
+		//-----------------------------------------------------------------------------------------------------
+		// Wakes the worker up if it's parked. The fence pairs with the one in Park(): either the worker sees
+		// the request we've just pushed, or we see it parked and notify it
+		//-----------------------------------------------------------------------------------------------------
+		void Unpark()
+		{
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+
+			if (m_parked.load(std::memory_order_relaxed))
+			{
 				{
-					// Sleep
-					while (m_execQueueSize <= 0 && m_running)
-						m_execWakeupCond.wait(lock);
+					std::lock_guard<std::mutex> lock(m_parkMutex);
 				}
-				else // we have something to run
+				m_parkCond.notify_one();
+			}
+		}
+
+		//-----------------------------------------------------------------------------------------------------
+		// Sleeps until a request is enqueued, the worker is stopped or the deadline (if any) expires
+		//-----------------------------------------------------------------------------------------------------
+		void Park(const std::chrono::steady_clock::time_point* deadline)
+		{
+			std::unique_lock<std::mutex> lock(m_parkMutex);
+
+			m_parked.store(true, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+
+			auto ready = [this]() { return !m_execQueue.Empty() || !m_running; };
+
+			if (deadline)
+				m_parkCond.wait_until(lock, *deadline, ready);
+			else
+				m_parkCond.wait(lock, ready);
+
+			m_parked.store(false, std::memory_order_relaxed);
+		}
+
+		//-----------------------------------------------------------------------------------------------------
+		// Moves into 'batch' the fire-and-forget requests at the front of the queue.
+		// Only a contiguous run is taken: a request that expects a response ends the batch, so the order of the
+		// requests of an account (which are all on this worker) is the same as their enqueue order
+		//-----------------------------------------------------------------------------------------------------
+		void CollectBatch(std::vector<DBRequest>& batch)
+		{
+			auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(BATCH_WINDOW_MS);
+
+			while (batch.size() < BATCH_MAX_REQUESTS)
+			{
+				DBRequest* front = m_execQueue.Front();
+
+				if (front)
 				{
-					// We have lock here
+					if (!front->m_fireAndForget)
+						break;
 
-					DBRequest req = std::move(m_execQueue.front());
-					m_execQueue.pop();
-					m_execQueueSize--;
+					batch.push_back(m_execQueue.PopFront());
+					continue;
+				}
 
-					lock.unlock();
+				// Queue is empty, give it the window to fill the batch up
+				if (!m_running || std::chrono::steady_clock::now() >= deadline)
+					break;
 
-					// Do stuff
-					try
-					{
-						req.m_sqlRes = req.m_sqlStmt.execute();
-						// Simulate load
-						Sleep(3000);
+				Park(&deadline);
+			}
+		}
 
-						// Check if this request needs to trigger a callback, if so, we enqueue it in the response queue
-						if (!req.m_fireAndForget)
+		//-----------------------------------------------------------------------------------------------------
+		// Hands the executed request to the reactor that made it. If its ring is full we keep waking the reactor
+		// up until it makes room, the response can't be dropped while we're running
+		//-----------------------------------------------------------------------------------------------------
+		void DeliverResponse(DBRequest&& req)
+		{
+			// Preserve the life of the m_noticeFunc in this scope before it gets moved
+			std::function<void()> func = std::move(req.m_noticeFunc);
+			DBResponseQueue* respQueue = req.m_respQueue;
+
+			while (!respQueue->Push(m_index, std::move(req)))
+			{
+				if (!m_running)
+				{
+					LOG_WARNING("DatabaseWorker {} dropped a response while stopping, the reactor's queue is full.", m_index);
+					return;
+				}
+
+				if (func)
+					func();
+
+				std::this_thread::yield();
+			}
+
+			// Call notice function if set
+			if (func)
+				func();
+		}
+
+		//-----------------------------------------------------------------------------------------------------
+		// Executes the fire-and-forget batch in a single transaction, merging consecutive executions of the
+		// same multi-row INSERT statement in one statement. If the transaction fails, it's rolled back and
+		// the requests are executed one by one, so a bad row doesn't take the others with it
+		//-----------------------------------------------------------------------------------------------------
+		void ExecuteBatch(std::vector<DBRequest>& batch)
+		{
+			try
+			{
+				if (batch.size() == 1)
+				{
+					if (ExecuteRequest(batch[0]) == 0)
+						RecordLatency(batch[0].m_enqueueTime);
+					return;
+				}
+
+				uint64_t coalesced = 0;
+				bool committed = false;
+
+				try
+				{
+					m_db->StartTransaction();
+
+					size_t i = 0;
+					while (i < batch.size())
+					{
+						// Find the run of the same statement
+						size_t runEnd = i + 1;
+						if (m_db->IsMultiRowInsert(batch[i].m_stmtID))
 						{
-							std::unique_lock<std::mutex> resGuard(m_respMutex);
+							while (runEnd < batch.size() && batch[runEnd].m_stmtID == batch[i].m_stmtID)
+								runEnd++;
+						}
 
-							
-							// Preserve the life of the m_noticeFunc in this scope before it gets moved
-							std::function<void()> func = std::move(req.m_noticeFunc);
-							m_respQueue.push(std::move(req));
+						if (runEnd - i == 1)
+						{
+							mysqlx::SqlStatement stmt = m_db->GetStatement(batch[i].m_stmtID);
+							for (mysqlx::Value& v : batch[i].m_params)
+								stmt.bind(v);
 
-							resGuard.unlock();
+							stmt.execute();
+						}
+						else
+						{
+							mysqlx::SqlStatement stmt = m_db->MakeStatement(m_db->BuildMultiRowInsertSQL(batch[i].m_stmtID, runEnd - i));
+							for (size_t r = i; r < runEnd; r++)
+								for (mysqlx::Value& v : batch[r].m_params)
+									stmt.bind(v);
 
-							// Call notice function if set
-							if (func)
-								func();
+							stmt.execute();
+							coalesced += runEnd - i;
 						}
+
+						i = runEnd;
 					}
-					catch (const mysqlx::Error& err)  // catches MySQL Connector/C++ specific exceptions
-					{
-						std::cerr << "DBWorker MySQL error: " << err.what() << std::endl;
-					}
-					catch (const std::exception& ex)  // catches standard exceptions
-					{
-						std::cerr << "DBWorker Standard exception: " << ex.what() << std::endl;
-					}
-					catch (...)
-					{
-						std::cerr << "DBWorker Unknown exception caught!" << std::endl;
-					}
+
+					m_db->Commit();
+					committed = true;
+				}
+				catch (const mysqlx::Error& err)
+				{
+					std::cerr << "DBWorker MySQL error while flushing a batch of " << batch.size() << " requests: " << err.what() << std::endl;
+					m_db->Rollback();
+				}
+
+				if (!committed)
+				{
+					// ExecuteRequest takes care of reconnecting if the session was lost
+					for (DBRequest& r : batch)
+						if (ExecuteRequest(r) == 0)
+							RecordLatency(r.m_enqueueTime);
+
+					return;
 				}
+
+				for (DBRequest& r : batch)
+					RecordLatency(r.m_enqueueTime);
+
+				m_batchesCount.fetch_add(1, std::memory_order_relaxed);
+				m_batchedRequestsCount.fetch_add(batch.size(), std::memory_order_relaxed);
+				m_coalescedRowsCount.fetch_add(coalesced, std::memory_order_relaxed);
+			}
+			catch (const std::exception& ex)  // catches standard exceptions
+			{
+				std::cerr << "DBWorker Standard exception: " << ex.what() << std::endl;
+			}
+			catch (...)
+			{
+				std::cerr << "DBWorker Unknown exception caught!" << std::endl;
+			}
+		}
+
+		void ThreadRoutine()
+		{
+			while (true)
+			{
+				DBRequest* front = m_execQueue.Front();
+
+				if (!front)
+				{
+					// If we Stopped the thread and there's nothing in the queue, exit
+					if (!m_running)
+						break;
+
+					// Sleep
+					Park(nullptr);
+					continue;
+				}
+
+				// We have something to run
+				DBRequest req = m_execQueue.PopFront();
+
+				if (req.m_fireAndForget)
+				{
+					std::vector<DBRequest> batch;
+					batch.push_back(std::move(req));
+					CollectBatch(batch);
+
+					ExecuteBatch(batch);
+					continue;
+				}
+
+				// Do stuff
+				int res = -1;
+				try
+				{
+					res = ExecuteRequest(req);
+				}
+				catch (const std::exception& ex)  // catches standard exceptions
+				{
+					std::cerr << "DBWorker Standard exception: " << ex.what() << std::endl;
+				}
+				catch (...)
+				{
+					std::cerr << "DBWorker Unknown exception caught!" << std::endl;
+				}
+
+				if (res == 0)
+					RecordLatency(req.m_enqueueTime);
+				else
+					req.m_failed = true;
+
+				// Check if this request needs to trigger a callback, if so, we deliver it to the response queue
+				// Failed requests are delivered too, the caller is waiting for an answer either way
+				if (req.m_respQueue)
+					DeliverResponse(std::move(req));
 			}
 		}
 	};
@@ -0,0 +1,137 @@
+#ifndef NECRO_DATABASE_WORKER_POOL_H
+#define NECRO_DATABASE_WORKER_POOL_H
+
+#include <vector>
+#include <memory>
+#include <string>
+#include <functional>
+
+#include "DatabaseWorker.h"
+
+namespace NECRO
+{
+	//-----------------------------------------------------------------------------------------------------
+	// A pool of DatabaseWorkers, each one with its own thread and its own DBConnection.
+	// Requests are sharded by an ordering key: requests with the same key always land on the same worker,
+	// so they're executed in the order they were enqueued, while unrelated ones run in parallel.
+	//-----------------------------------------------------------------------------------------------------
+	class DatabaseWorkerPool
+	{
+	private:
+		std::vector<std::unique_ptr<DatabaseWorker>> m_workers;
+
+		size_t GetWorkerIndex(uint64_t orderingKey) const
+		{
+			// Mix the key (splitmix64 finalizer) so sequential account IDs spread evenly
+			uint64_t h = orderingKey;
+			h ^= h >> 30; h *= 0xbf58476d1ce4e5b9ULL;
+			h ^= h >> 27; h *= 0x94d049bb133111ebULL;
+			h ^= h >> 31;
+
+			return static_cast<size_t>(h % m_workers.size());
+		}
+
+	public:
+		int Setup(Database::DBType t, size_t workersCount)
+		{
+			if (workersCount == 0)
+				workersCount = 1;
+
+			for (size_t i = 0; i < workersCount; i++)
+			{
+				std::unique_ptr<DatabaseWorker> w = std::make_unique<DatabaseWorker>(i);
+
+				if (w->Setup(t) != 0)
+				{
+					LOG_ERROR("Could not setup DatabaseWorker {} of the pool.", i);
+					return 1;
+				}
+
+				m_workers.push_back(std::move(w));
+			}
+
+			return 0;
+		}
+
+		int Start()
+		{
+			for (auto& w : m_workers)
+				if (w->Start() != 0)
+					return 1;
+
+			return 0;
+		}
+
+		void Stop()
+		{
+			for (auto& w : m_workers)
+				w->Stop();
+		}
+
+		void Join()
+		{
+			for (auto& w : m_workers)
+				w->Join();
+		}
+
+		void CloseDB()
+		{
+			for (auto& w : m_workers)
+				w->CloseDB();
+		}
+
+		//-----------------------------------------------------------------------------------------------------
+		// Enqueues the request on the worker that owns orderingKey (ex. the accountID).
+		// Returns false if that worker's queue is full
+		//-----------------------------------------------------------------------------------------------------
+		bool Enqueue(DBRequest&& r, uint64_t orderingKey)
+		{
+			return m_workers[GetWorkerIndex(orderingKey)]->Enqueue(std::move(r));
+		}
+
+		bool Enqueue(DBRequest&& r, const std::string& orderingKey)
+		{
+			return Enqueue(std::move(r), static_cast<uint64_t>(std::hash<std::string>{}(orderingKey)));
+		}
+
+		//-----------------------------------------------------------------------------------------------------
+		// Back-pressure signal, true if the worker that owns orderingKey is close to being full
+		//-----------------------------------------------------------------------------------------------------
+		bool IsUnderPressure(uint64_t orderingKey) const
+		{
+			return m_workers[GetWorkerIndex(orderingKey)]->IsUnderPressure();
+		}
+
+		size_t GetSize() const
+		{
+			return m_workers.size();
+		}
+
+		std::vector<DatabaseWorker::Stats> GetStats()
+		{
+			std::vector<DatabaseWorker::Stats> stats;
+			stats.reserve(m_workers.size());
+
+			for (auto& w : m_workers)
+				stats.push_back(w->GetStats());
+
+			return stats;
+		}
+
+		void LogStats()
+		{
+			std::vector<DatabaseWorker::Stats> stats = GetStats();
+
+			LOG_INFO("DatabaseWorkerPool: {} workers.", stats.size());
+			for (size_t i = 0; i < stats.size(); i++)
+			{
+				LOG_INFO("DatabaseWorker {}: queue depth {}/{} (high-water {}, rejected {}) | executed {} | avg latency {:.3f} ms | max latency {:.3f} ms | batches {} ({} requests, {} rows coalesced)",
+							i, stats[i].queueDepth, stats[i].queueCapacity, stats[i].queueHighWaterMark, stats[i].rejected, stats[i].executed, stats[i].avgLatencyMs, stats[i].maxLatencyMs,
+							stats[i].batches, stats[i].batchedRequests, stats[i].coalescedRows);
+			}
+		}
+	};
+
+}
+
+#endif
@@ -8,7 +8,8 @@ namespace Auth
     // Status of the sockets during communication
     enum class SocketStatus
     {
-        GATHER_INFO = 0,
+        TLS_HANDSHAKE = 0,  // server-side only, the TLS handshake is being driven by readiness events
+        GATHER_INFO,
         LOGIN_ATTEMPT,
         AUTHED,
         CLOSED
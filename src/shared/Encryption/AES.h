@@ -2,6 +2,8 @@
 #define NECRO_AES_H
 
 #include <array>
+#include <cstring>
+#include <memory>
 #include <stdexcept>
 
 #include <openssl/evp.h>
@@ -63,48 +65,59 @@ namespace NECRO
 			return k;
 		}
 
-		static int Encrypt(unsigned char* plaintext, int plaintext_len,
+		// Frees the EVP_CIPHER_CTX on every return path
+		struct CipherCtxDeleter
+		{
+			void operator()(EVP_CIPHER_CTX* ctx) const { EVP_CIPHER_CTX_free(ctx); }
+		};
+
+		typedef std::unique_ptr<EVP_CIPHER_CTX, CipherCtxDeleter> CipherCtxPtr;
+
+		//-----------------------------------------------------------------------------------------------------------
+		// One-shot encrypt, creates and keys a context for this single message.
+		// For a stream of messages with the same key, use a SessionCipher instead.
+		//-----------------------------------------------------------------------------------------------------------
+		inline int Encrypt(unsigned char* plaintext, int plaintext_len,
 			unsigned char* aad, int aad_len,
 			unsigned char* key,
 			unsigned char* iv, int iv_len,
 			unsigned char* ciphertext,
 			unsigned char* tag)
 		{
-			EVP_CIPHER_CTX* ctx;
 			int len;
 			int ciphertext_len;
 
-
 			/* Create and initialise the context */
-			if (!(ctx = EVP_CIPHER_CTX_new()))
+			CipherCtxPtr ctx(EVP_CIPHER_CTX_new());
+			if (!ctx)
 				return -1;
 
 			/* Initialise the encryption operation. */
-			if (1 != EVP_EncryptInit_ex(ctx, EVP_aes_128_gcm(), NULL, NULL, NULL))
+			if (1 != EVP_EncryptInit_ex(ctx.get(), EVP_aes_128_gcm(), NULL, NULL, NULL))
 				return -1;
 
 			/*
 			 * Set IV length if default 12 bytes (96 bits) is not appropriate
 			 */
-			if (1 != EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, iv_len, NULL))
+			if (1 != EVP_CIPHER_CTX_ctrl(ctx.get(), EVP_CTRL_GCM_SET_IVLEN, iv_len, NULL))
 				return -3;
 
 			/* Initialise key and IV */
-			if (1 != EVP_EncryptInit_ex(ctx, NULL, NULL, key, iv))
+			if (1 != EVP_EncryptInit_ex(ctx.get(), NULL, NULL, key, iv))
 				return -4;
 
 			/*
 			 * Provide any AAD data. This can be called zero or more times as
 			 * required
 			 */
-			if (1 != EVP_EncryptUpdate(ctx, NULL, &len, aad, aad_len))
+			if (aad_len > 0 && 1 != EVP_EncryptUpdate(ctx.get(), NULL, &len, aad, aad_len))
 				return -5;
 
 			/*
 			 * Provide the message to be encrypted, and obtain the encrypted output.
 			 * EVP_EncryptUpdate can be called multiple times if necessary
 			 */
-			if (1 != EVP_EncryptUpdate(ctx, ciphertext, &len, plaintext, plaintext_len))
+			if (1 != EVP_EncryptUpdate(ctx.get(), ciphertext, &len, plaintext, plaintext_len))
 				return -6;
 			ciphertext_len = len;
 
@@ -112,20 +125,21 @@ namespace NECRO
 			 * Finalise the encryption. Normally ciphertext bytes may be written at
 			 * this stage, but this does not occur in GCM mode
 			 */
-			if (1 != EVP_EncryptFinal_ex(ctx, ciphertext + len, &len))
+			if (1 != EVP_EncryptFinal_ex(ctx.get(), ciphertext + len, &len))
 				return -7;
 			ciphertext_len += len;
 
 			/* Get the tag */
-			if (1 != EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, 16, tag))
+			if (1 != EVP_CIPHER_CTX_ctrl(ctx.get(), EVP_CTRL_GCM_GET_TAG, GCM_TAG_SIZE, tag))
 				return -8;
 
-			/* Clean up */
-			EVP_CIPHER_CTX_free(ctx);
-
 			return ciphertext_len;
 		}
 
+		//-----------------------------------------------------------------------------------------------------------
+		// One-shot decrypt, creates and keys a context for this single message.
+		// For a stream of messages with the same key, use a SessionCipher instead.
+		//-----------------------------------------------------------------------------------------------------------
 		inline int Decrypt(unsigned char* ciphertext, int ciphertext_len,
 			unsigned char* aad, int aad_len,
 			unsigned char* tag,
@@ -133,56 +147,50 @@ namespace NECRO
 			unsigned char* iv, int iv_len,
 			unsigned char* plaintext)
 		{
-			EVP_CIPHER_CTX* ctx;
 			int len;
 			int plaintext_len;
-			int ret;
 
 			/* Create and initialise the context */
-			if (!(ctx = EVP_CIPHER_CTX_new()))
+			CipherCtxPtr ctx(EVP_CIPHER_CTX_new());
+			if (!ctx)
 				return -1;
 
 			/* Initialise the decryption operation. */
-			if (!EVP_DecryptInit_ex(ctx, EVP_aes_128_gcm(), NULL, NULL, NULL))
+			if (!EVP_DecryptInit_ex(ctx.get(), EVP_aes_128_gcm(), NULL, NULL, NULL))
 				return -2;
 
 			/* Set IV length. Not necessary if this is 12 bytes (96 bits) */
-			if (!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, iv_len, NULL))
+			if (!EVP_CIPHER_CTX_ctrl(ctx.get(), EVP_CTRL_GCM_SET_IVLEN, iv_len, NULL))
 				return -3;
 
 			/* Initialise key and IV */
-			if (!EVP_DecryptInit_ex(ctx, NULL, NULL, key, iv))
+			if (!EVP_DecryptInit_ex(ctx.get(), NULL, NULL, key, iv))
 				return -4;
 
 			/*
 			 * Provide any AAD data. This can be called zero or more times as
 			 * required
 			 */
-			if (!EVP_DecryptUpdate(ctx, NULL, &len, aad, aad_len))
+			if (aad_len > 0 && !EVP_DecryptUpdate(ctx.get(), NULL, &len, aad, aad_len))
 				return -5;
 
 			/*
 			 * Provide the message to be decrypted, and obtain the plaintext output.
 			 * EVP_DecryptUpdate can be called multiple times if necessary
 			 */
-			if (!EVP_DecryptUpdate(ctx, plaintext, &len, ciphertext, ciphertext_len))
+			if (!EVP_DecryptUpdate(ctx.get(), plaintext, &len, ciphertext, ciphertext_len))
 				return -6;
 			plaintext_len = len;
 
 			/* Set expected tag value. Works in OpenSSL 1.0.1d and later */
-			if (!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, 16, tag))
+			if (!EVP_CIPHER_CTX_ctrl(ctx.get(), EVP_CTRL_GCM_SET_TAG, GCM_TAG_SIZE, tag))
 				return -7;
 
 			/*
 			 * Finalise the decryption. A positive return value indicates success,
 			 * anything else is a failure - the plaintext is not trustworthy.
 			 */
-			ret = EVP_DecryptFinal_ex(ctx, plaintext + len, &len);
-
-			/* Clean up */
-			EVP_CIPHER_CTX_free(ctx);
-
-			if (ret > 0)
+			if (EVP_DecryptFinal_ex(ctx.get(), plaintext + len, &len) > 0)
 			{
 				/* Success */
 				plaintext_len += len;
@@ -195,6 +203,138 @@ namespace NECRO
 			}
 		}
 
+		//-----------------------------------------------------------------------------------------------------------
+		// AES-128-GCM contexts bound to a session key.
+		// The key schedule is computed once in SetKey(), every message only sets its IV, so the per-message
+		// cost is the actual encryption instead of allocating and keying a new EVP_CIPHER_CTX.
+		// A SessionCipher is owned by a single connection and must not be used by two threads at once.
+		//-----------------------------------------------------------------------------------------------------------
+		class SessionCipher
+		{
+		private:
+			CipherCtxPtr m_encCtx;
+			CipherCtxPtr m_decCtx;
+			bool m_keyed = false;
+
+		public:
+			SessionCipher() = default;
+
+			SessionCipher(const SessionCipher&) = delete;
+			SessionCipher& operator=(const SessionCipher&) = delete;
+
+			SessionCipher(SessionCipher&&) noexcept = default;
+			SessionCipher& operator=(SessionCipher&&) noexcept = default;
+
+			bool IsKeyed() const { return m_keyed; }
+
+			//-----------------------------------------------------------------------------------------------------------
+			// Creates (first time) and keys both contexts, can be called again to switch key
+			//-----------------------------------------------------------------------------------------------------------
+			int SetKey(const unsigned char* key)
+			{
+				m_keyed = false;
+
+				if (!m_encCtx)
+					m_encCtx.reset(EVP_CIPHER_CTX_new());
+				if (!m_decCtx)
+					m_decCtx.reset(EVP_CIPHER_CTX_new());
+
+				if (!m_encCtx || !m_decCtx)
+					return -1;
+
+				if (1 != EVP_EncryptInit_ex(m_encCtx.get(), EVP_aes_128_gcm(), NULL, NULL, NULL) ||
+					1 != EVP_CIPHER_CTX_ctrl(m_encCtx.get(), EVP_CTRL_GCM_SET_IVLEN, GCM_IV_SIZE, NULL) ||
+					1 != EVP_EncryptInit_ex(m_encCtx.get(), NULL, NULL, key, NULL))
+					return -2;
+
+				if (1 != EVP_DecryptInit_ex(m_decCtx.get(), EVP_aes_128_gcm(), NULL, NULL, NULL) ||
+					1 != EVP_CIPHER_CTX_ctrl(m_decCtx.get(), EVP_CTRL_GCM_SET_IVLEN, GCM_IV_SIZE, NULL) ||
+					1 != EVP_DecryptInit_ex(m_decCtx.get(), NULL, NULL, key, NULL))
+					return -3;
+
+				m_keyed = true;
+				return 0;
+			}
+
+			//-----------------------------------------------------------------------------------------------------------
+			// Same contract as AES::Encrypt, iv must be GCM_IV_SIZE bytes. ciphertext may be equal to plaintext (in-place)
+			//-----------------------------------------------------------------------------------------------------------
+			int Encrypt(const unsigned char* plaintext, int plaintext_len,
+				const unsigned char* aad, int aad_len,
+				const unsigned char* iv,
+				unsigned char* ciphertext,
+				unsigned char* tag)
+			{
+				if (!m_keyed)
+					return -1;
+
+				EVP_CIPHER_CTX* ctx = m_encCtx.get();
+				int len;
+				int ciphertext_len;
+
+				// Only the IV changes, the key schedule is kept
+				if (1 != EVP_EncryptInit_ex(ctx, NULL, NULL, NULL, iv))
+					return -4;
+
+				if (aad_len > 0 && 1 != EVP_EncryptUpdate(ctx, NULL, &len, aad, aad_len))
+					return -5;
+
+				if (1 != EVP_EncryptUpdate(ctx, ciphertext, &len, plaintext, plaintext_len))
+					return -6;
+				ciphertext_len = len;
+
+				if (1 != EVP_EncryptFinal_ex(ctx, ciphertext + len, &len))
+					return -7;
+				ciphertext_len += len;
+
+				if (1 != EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, GCM_TAG_SIZE, tag))
+					return -8;
+
+				return ciphertext_len;
+			}
+
+			//-----------------------------------------------------------------------------------------------------------
+			// Same contract as AES::Decrypt, iv must be GCM_IV_SIZE bytes. plaintext may be equal to ciphertext (in-place)
+			//-----------------------------------------------------------------------------------------------------------
+			int Decrypt(const unsigned char* ciphertext, int ciphertext_len,
+				const unsigned char* aad, int aad_len,
+				const unsigned char* tag,
+				const unsigned char* iv,
+				unsigned char* plaintext)
+			{
+				if (!m_keyed)
+					return -1;
+
+				EVP_CIPHER_CTX* ctx = m_decCtx.get();
+				int len;
+				int plaintext_len;
+
+				// Only the IV changes, the key schedule is kept
+				if (!EVP_DecryptInit_ex(ctx, NULL, NULL, NULL, iv))
+					return -4;
+
+				if (aad_len > 0 && !EVP_DecryptUpdate(ctx, NULL, &len, aad, aad_len))
+					return -5;
+
+				if (!EVP_DecryptUpdate(ctx, plaintext, &len, ciphertext, ciphertext_len))
+					return -6;
+				plaintext_len = len;
+
+				if (!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, GCM_TAG_SIZE, const_cast<unsigned char*>(tag)))
+					return -7;
+
+				if (EVP_DecryptFinal_ex(ctx, plaintext + len, &len) > 0)
+				{
+					plaintext_len += len;
+					return plaintext_len;
+				}
+				else
+				{
+					/* Verify failed */
+					return -1;
+				}
+			}
+		};
 	}
 }
 
@@ -1,9 +1,225 @@
 #include "OpenSSLManager.h"
 
+#include <cstring>
+
+#include <openssl/core_names.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
 namespace NECRO
 {
 	// Static member definitions
 	SSL_CTX* OpenSSLManager::s_server_ctx = nullptr;
 	SSL_CTX* OpenSSLManager::s_client_ctx = nullptr;
 	const std::array<unsigned char, 4> OpenSSLManager::s_cache_id = { {0xDE, 0xAD, 0xBE, 0xEF} };
+
+	std::array<OpenSSLManager::TicketKey, 2> OpenSSLManager::s_ticketKeys;
+	std::mutex OpenSSLManager::s_ticketKeysMutex;
+
+	std::unordered_map<std::string, SSL_SESSION*> OpenSSLManager::s_clientSessions;
+	std::mutex OpenSSLManager::s_clientSessionsMutex;
+
+	std::atomic<uint64_t> OpenSSLManager::s_fullHandshakes{ 0 };
+	std::atomic<uint64_t> OpenSSLManager::s_resumedHandshakes{ 0 };
+
+	bool OpenSSLManager::s_ktlsEnabled = false;
+	std::atomic<uint64_t> OpenSSLManager::s_ktlsSendSessions{ 0 };
+	std::atomic<uint64_t> OpenSSLManager::s_ktlsRecvSessions{ 0 };
+
+	TLSSessionCache* OpenSSLManager::s_externalCache = nullptr;
+	std::atomic<uint64_t> OpenSSLManager::s_externalCacheHits{ 0 };
+	std::atomic<uint64_t> OpenSSLManager::s_externalCacheMisses{ 0 };
+
+	//-----------------------------------------------------------------------------------------------------
+	// Makes a new current ticket key, the current one becomes the previous one. Caller holds s_ticketKeysMutex (or is the init)
+	//-----------------------------------------------------------------------------------------------------
+	int OpenSSLManager::RotateTicketKeys()
+	{
+		TicketKey key;
+
+		if (RAND_bytes(key.name.data(), static_cast<int>(key.name.size())) != 1 ||
+			RAND_bytes(key.aesKey.data(), static_cast<int>(key.aesKey.size())) != 1 ||
+			RAND_bytes(key.hmacKey.data(), static_cast<int>(key.hmacKey.size())) != 1)
+		{
+			LOG_ERROR("OpenSSLManager: could not generate a new session ticket key.");
+			return -1;
+		}
+
+		key.created = std::chrono::steady_clock::now();
+		key.valid = true;
+
+		s_ticketKeys[1] = s_ticketKeys[0];
+		s_ticketKeys[0] = key;
+
+		LOG_INFO("OpenSSLManager: session ticket keys rotated.");
+		return 0;
+	}
+
+	int OpenSSLManager::SetTicketMACKey(EVP_MAC_CTX* hctx, const TicketKey& key)
+	{
+		OSSL_PARAM params[3];
+		params[0] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, const_cast<unsigned char*>(key.hmacKey.data()), key.hmacKey.size());
+		params[1] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, const_cast<char*>("SHA256"), 0);
+		params[2] = OSSL_PARAM_construct_end();
+
+		return EVP_MAC_CTX_set_params(hctx, params);
+	}
+
+	//-----------------------------------------------------------------------------------------------------
+	// Seals (enc = 1) or opens (enc = 0) a session ticket, called by OpenSSL on the reactor threads.
+	// Returns 1 to use the ticket, 2 to use it and issue a new one, 0 to ignore it (full handshake), -1 on error
+	//-----------------------------------------------------------------------------------------------------
+	int OpenSSLManager::TicketKeyCallback(SSL* s, unsigned char keyName[16], unsigned char* iv, EVP_CIPHER_CTX* ctx, EVP_MAC_CTX* hctx, int enc)
+	{
+		std::lock_guard<std::mutex> lock(s_ticketKeysMutex);
+
+		if (enc)
+		{
+			if (std::chrono::steady_clock::now() - s_ticketKeys[0].created >= std::chrono::seconds(TICKET_KEY_ROTATION_SECONDS))
+				RotateTicketKeys(); // on failure we keep sealing with the current key
+
+			const TicketKey& key = s_ticketKeys[0];
+
+			if (RAND_bytes(iv, EVP_MAX_IV_LENGTH) != 1)
+				return -1;
+
+			std::memcpy(keyName, key.name.data(), key.name.size());
+
+			if (EVP_EncryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, key.aesKey.data(), iv) != 1 || SetTicketMACKey(hctx, key) != 1)
+				return -1;
+
+			return 1;
+		}
+
+		for (size_t i = 0; i < s_ticketKeys.size(); i++)
+		{
+			const TicketKey& key = s_ticketKeys[i];
+
+			if (!key.valid || std::memcmp(keyName, key.name.data(), key.name.size()) != 0)
+				continue;
+
+			if (SetTicketMACKey(hctx, key) != 1 || EVP_DecryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, key.aesKey.data(), iv) != 1)
+				return -1;
+
+			// Always ask for a new ticket: clients use a ticket once, without a fresh one their next reconnect would be a full handshake
+			return 2;
+		}
+
+		// Unknown key (rotated out), fall back to a full handshake
+		return 0;
+	}
+
+	//-----------------------------------------------------------------------------------------------------
+	// Client side, a server sent us a session: keep it for the next connection to the same host
+	//-----------------------------------------------------------------------------------------------------
+	int OpenSSLManager::ClientNewSessionCallback(SSL* s, SSL_SESSION* sess)
+	{
+		const char* hostname = SSL_get_servername(s, TLSEXT_NAMETYPE_host_name);
+
+		if (hostname == nullptr || !SSL_SESSION_is_resumable(sess))
+			return 0;
+
+		// Keep a copy: the connection's own session is marked as not resumable if the connection isn't shut down cleanly
+		SSL_SESSION* copy = SSL_SESSION_dup(sess);
+		if (copy == nullptr)
+			return 0;
+
+		SSL_SESSION* old = nullptr;
+		{
+			std::lock_guard<std::mutex> lock(s_clientSessionsMutex);
+
+			SSL_SESSION*& slot = s_clientSessions[hostname];
+			old = slot;
+			slot = copy;
+		}
+
+		if (old)
+			SSL_SESSION_free(old);
+
+		return 0; // we didn't take the reference to sess
+	}
+
+	//-----------------------------------------------------------------------------------------------------
+	// Client side, offers the stored session for hostname (if any) so the handshake can be resumed.
+	// TLS 1.3 tickets are meant to be used once, the session is removed from the store, the server will send a new one
+	//-----------------------------------------------------------------------------------------------------
+	void OpenSSLManager::ClientOfferSession(SSL* s, const char* hostname)
+	{
+		SSL_SESSION* sess = nullptr;
+		{
+			std::lock_guard<std::mutex> lock(s_clientSessionsMutex);
+
+			auto it = s_clientSessions.find(hostname);
+			if (it == s_clientSessions.end())
+				return;
+
+			sess = it->second;
+			s_clientSessions.erase(it);
+		}
+
+		if (SSL_SESSION_is_resumable(sess) && SSL_set_session(s, sess) != 1)
+		{
+			LOG_WARNING("OpenSSLManager: could not offer the stored session for {}.", hostname);
+		}
+
+		SSL_SESSION_free(sess);
+	}
+
+	//-----------------------------------------------------------------------------------------------------
+	// Server side, a new session was established: serialize it in the external cache
+	//-----------------------------------------------------------------------------------------------------
+	int OpenSSLManager::ExternalNewSessionCallback(SSL* s, SSL_SESSION* sess)
+	{
+		unsigned int idLen = 0;
+		const unsigned char* id = SSL_SESSION_get_id(sess, &idLen);
+
+		int derLen = i2d_SSL_SESSION(sess, nullptr);
+		if (derLen <= 0)
+			return 0;
+
+		std::vector<uint8_t> der(static_cast<size_t>(derLen));
+		unsigned char* p = der.data();
+		i2d_SSL_SESSION(sess, &p);
+
+		std::time_t expiresAt = static_cast<std::time_t>(SSL_SESSION_get_time(sess) + SSL_SESSION_get_timeout(sess));
+		s_externalCache->Store(id, idLen, der.data(), der.size(), expiresAt);
+
+		return 0; // we didn't take the reference to sess
+	}
+
+	//-----------------------------------------------------------------------------------------------------
+	// Server side, a client offered a session the in-process cache doesn't have (e.g. made by another process)
+	//-----------------------------------------------------------------------------------------------------
+	SSL_SESSION* OpenSSLManager::ExternalGetSessionCallback(SSL* s, const unsigned char* id, int idLen, int* copy)
+	{
+		*copy = 0; // OpenSSL owns the session we return
+
+		thread_local std::vector<uint8_t> der;
+		if (idLen <= 0 || !s_externalCache->Fetch(id, static_cast<size_t>(idLen), der))
+		{
+			s_externalCacheMisses.fetch_add(1, std::memory_order_relaxed);
+			return nullptr;
+		}
+
+		const unsigned char* p = der.data();
+		SSL_SESSION* sess = d2i_SSL_SESSION(nullptr, &p, static_cast<long>(der.size()));
+
+		if (sess)
+			s_externalCacheHits.fetch_add(1, std::memory_order_relaxed);
+		else
+			s_externalCacheMisses.fetch_add(1, std::memory_order_relaxed);
+
+		return sess;
+	}
+
+	//-----------------------------------------------------------------------------------------------------
+	// Server side, the session is no longer valid (used TLS 1.3 ticket, expired, failed connection)
+	//-----------------------------------------------------------------------------------------------------
+	void OpenSSLManager::ExternalRemoveSessionCallback(SSL_CTX* ctx, SSL_SESSION* sess)
+	{
+		unsigned int idLen = 0;
+		const unsigned char* id = SSL_SESSION_get_id(sess, &idLen);
+
+		s_externalCache->Remove(id, idLen);
+	}
 }
@@ -3,6 +3,7 @@
 
 #include "ConsoleLogger.h"
 #include "FileLogger.h"
+#include "TLSSessionCache.h"
 
 #ifdef _WIN32
 	#include "WinSock2.h"
@@ -11,6 +12,12 @@
 
 
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
 #include <openssl/ssl.h>
 
 namespace NECRO
@@ -21,15 +28,94 @@ namespace NECRO
 		typedef int sock_t;
 	#endif
 
+	// Lifetime of a TLS session (and of the tickets that carry it)
+	inline constexpr int TLS_SESSION_TIMEOUT_SECONDS = 3600;
+
+	// Session ticket keys are replaced every TICKET_KEY_ROTATION_SECONDS, tickets sealed with the previous key are still accepted (and renewed)
+	inline constexpr int TICKET_KEY_ROTATION_SECONDS = TLS_SESSION_TIMEOUT_SECONDS;
+
 	class OpenSSLManager
 	{
+	public:
+		struct HandshakeStats
+		{
+			uint64_t full;
+			uint64_t resumed;
+			uint64_t ktlsSend;	// sessions whose record encryption has been offloaded to the kernel
+			uint64_t ktlsRecv;	// and decryption
+		};
+
 	private:
 		static SSL_CTX* s_server_ctx;
 		static SSL_CTX* s_client_ctx;
 
 		static const std::array<unsigned char, 4> s_cache_id;
 
+		// Keys used to seal the stateless session tickets: [0] is the current one, [1] the previous one
+		struct TicketKey
+		{
+			std::array<unsigned char, 16> name;
+			std::array<unsigned char, 32> aesKey;
+			std::array<unsigned char, 32> hmacKey;
+			std::chrono::steady_clock::time_point created;
+			bool valid = false;
+		};
+
+		static std::array<TicketKey, 2> s_ticketKeys;
+		static std::mutex s_ticketKeysMutex;
+
+		// Client side, last resumable session received from each server (by hostname)
+		static std::unordered_map<std::string, SSL_SESSION*> s_clientSessions;
+		static std::mutex s_clientSessionsMutex;
+
+		static std::atomic<uint64_t> s_fullHandshakes;
+		static std::atomic<uint64_t> s_resumedHandshakes;
+
+		// Kernel TLS, opt-in (see SetKTLSEnabled)
+		static bool s_ktlsEnabled;
+		static std::atomic<uint64_t> s_ktlsSendSessions;
+		static std::atomic<uint64_t> s_ktlsRecvSessions;
+
+		// Server side, optional cache shared with other processes (see SetExternalSessionCache)
+		static TLSSessionCache* s_externalCache;
+		static std::atomic<uint64_t> s_externalCacheHits;
+		static std::atomic<uint64_t> s_externalCacheMisses;
+
+		static int ExternalNewSessionCallback(SSL* s, SSL_SESSION* sess);
+		static SSL_SESSION* ExternalGetSessionCallback(SSL* s, const unsigned char* id, int idLen, int* copy);
+		static void ExternalRemoveSessionCallback(SSL_CTX* ctx, SSL_SESSION* sess);
+
+		static int RotateTicketKeys();
+		static int SetTicketMACKey(EVP_MAC_CTX* hctx, const TicketKey& key);
+		static int TicketKeyCallback(SSL* s, unsigned char keyName[16], unsigned char* iv, EVP_CIPHER_CTX* ctx, EVP_MAC_CTX* hctx, int enc);
+		static int ClientNewSessionCallback(SSL* s, SSL_SESSION* sess);
+
 	public:
+		//-----------------------------------------------------------------------------------------------------
+		// Makes the server keep its sessions in an external cache as well, to call before ServerInit().
+		// Stateless tickets are sealed with per-process keys, so with an external cache the server issues
+		// stateful tickets (session IDs) instead: any process that sees the same cache can resume them.
+		//-----------------------------------------------------------------------------------------------------
+		static void SetExternalSessionCache(TLSSessionCache* cache)
+		{
+			s_externalCache = cache;
+		}
+
+		//-----------------------------------------------------------------------------------------------------
+		// Asks OpenSSL to hand the record layer to the kernel (kTLS) once the handshake is done, to call before ServerInit().
+		// It only happens when the kernel has the tls module and supports the negotiated cipher, otherwise OpenSSL silently
+		// keeps doing it in userspace. RecordKTLS() tells what happened to a session
+		//-----------------------------------------------------------------------------------------------------
+		static void SetKTLSEnabled(bool enabled)
+		{
+			s_ktlsEnabled = enabled;
+		}
+
+		static bool IsKTLSEnabled()
+		{
+			return s_ktlsEnabled;
+		}
+
 		static int ServerInit()
 		{
 			OpenSSL_add_all_algorithms();
@@ -58,6 +144,29 @@ namespace NECRO
 			opts |= SSL_OP_NO_RENEGOTIATION;
 			opts |= SSL_OP_CIPHER_SERVER_PREFERENCE;
 
+			if (s_externalCache)
+				opts |= SSL_OP_NO_TICKET; // TLS 1.3 stateful tickets, looked up by ID
+
+			if (s_ktlsEnabled)
+			{
+#ifdef SSL_OP_ENABLE_KTLS
+				opts |= SSL_OP_ENABLE_KTLS;
+
+				// AES-GCM is what every kernel with kTLS can offload
+				if (SSL_CTX_set_ciphersuites(s_server_ctx, "TLS_AES_256_GCM_SHA384:TLS_AES_128_GCM_SHA256") != 1)
+				{
+					SSL_CTX_free(s_server_ctx);
+					LOG_ERROR("OpenSSLManager: failed to restrict the ciphersuites for kTLS.");
+					return 6;
+				}
+
+				LOG_OK("OpenSSLManager: kTLS requested, sessions will be offloaded to the kernel where it accepts them.");
+#else
+				LOG_WARNING("OpenSSLManager: kTLS requested but this OpenSSL doesn't support it, records will be encrypted in userspace.");
+				s_ktlsEnabled = false;
+#endif
+			}
+
 			SSL_CTX_set_options(s_server_ctx, opts);
 
 			// Set certificate and private key
@@ -79,11 +188,33 @@ namespace NECRO
 			SSL_CTX_set_session_id_context(s_server_ctx, OpenSSLManager::s_cache_id.data(), OpenSSLManager::s_cache_id.size());
 			SSL_CTX_set_session_cache_mode(s_server_ctx, SSL_SESS_CACHE_SERVER);
 			SSL_CTX_sess_set_cache_size(s_server_ctx, 1024);
-			SSL_CTX_set_timeout(s_server_ctx, 3600);
+			SSL_CTX_set_timeout(s_server_ctx, TLS_SESSION_TIMEOUT_SECONDS);
+
+			// Session tickets, so reconnecting clients can resume without a full handshake. One ticket per connection is enough, clients use it once
+			SSL_CTX_set_num_tickets(s_server_ctx, 1);
+
+			if (s_externalCache)
+			{
+				// The in-process cache stays in front of the external one
+				SSL_CTX_sess_set_new_cb(s_server_ctx, ExternalNewSessionCallback);
+				SSL_CTX_sess_set_get_cb(s_server_ctx, ExternalGetSessionCallback);
+				SSL_CTX_sess_set_remove_cb(s_server_ctx, ExternalRemoveSessionCallback);
+
+				LOG_OK("OpenSSLManager: TLS sessions are shared through the {} cache.", s_externalCache->GetName());
+			}
+			else if (RotateTicketKeys() != 0 || SSL_CTX_set_tlsext_ticket_key_evp_cb(s_server_ctx, TicketKeyCallback) != 1)
+			{
+				SSL_CTX_free(s_server_ctx);
+				LOG_ERROR("OpenSSLManager: failed to set up the session ticket keys.");
+				return 5;
+			}
 
 			// We don't need to verify client's certificates
 			SSL_CTX_set_verify(s_server_ctx, SSL_VERIFY_NONE, NULL);
 
+			// TCPSocket::Send() coalesces the outQueue in a scratch buffer and handles partial writes itself
+			SSL_CTX_set_mode(s_server_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
 			LOG_OK("OpenSSLManager: Initialization Completed!");
 			return 0;
 		}
@@ -117,6 +248,13 @@ namespace NECRO
 				return 3;
 			}
 
+			// TCPSocket::Send() coalesces the outQueue in a scratch buffer and handles partial writes itself
+			SSL_CTX_set_mode(s_client_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+			// Keep the sessions (tickets) the server sends us, they're offered back on the next connection (see ClientOfferSession)
+			SSL_CTX_set_session_cache_mode(s_client_ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+			SSL_CTX_sess_set_new_cb(s_client_ctx, ClientNewSessionCallback);
+
 			LOG_OK("OpenSSLManager: Initialization Completed!");
 			return 0;
 		}
@@ -194,6 +332,64 @@ namespace NECRO
 			SSL_set_bio(s, read, write);
 		}
 
+		static void ClientOfferSession(SSL* s, const char* hostname);
+
+		//-----------------------------------------------------------------------------------------------------
+		// Called when a handshake completes, counts whether it was resumed or a full one
+		//-----------------------------------------------------------------------------------------------------
+		static void RecordHandshake(SSL* s)
+		{
+			if (SSL_session_reused(s))
+				s_resumedHandshakes.fetch_add(1, std::memory_order_relaxed);
+			else
+				s_fullHandshakes.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		//-----------------------------------------------------------------------------------------------------
+		// Called when a handshake completes with kTLS enabled, counts the offloaded directions.
+		// Returns true if the kernel encrypts what's written on the socket, plain send() can be used from now on
+		//-----------------------------------------------------------------------------------------------------
+		static bool RecordKTLS(SSL* s)
+		{
+			if (!s_ktlsEnabled)
+				return false;
+
+			bool ktlsSend = BIO_get_ktls_send(SSL_get_wbio(s)) != 0;
+			bool ktlsRecv = BIO_get_ktls_recv(SSL_get_rbio(s)) != 0;
+
+			if (ktlsSend)
+				s_ktlsSendSessions.fetch_add(1, std::memory_order_relaxed);
+			if (ktlsRecv)
+				s_ktlsRecvSessions.fetch_add(1, std::memory_order_relaxed);
+
+			return ktlsSend;
+		}
+
+		static HandshakeStats GetHandshakeStats()
+		{
+			return { s_fullHandshakes.load(std::memory_order_relaxed), s_resumedHandshakes.load(std::memory_order_relaxed),
+					 s_ktlsSendSessions.load(std::memory_order_relaxed), s_ktlsRecvSessions.load(std::memory_order_relaxed) };
+		}
+
+		static void LogHandshakeStats()
+		{
+			HandshakeStats st = GetHandshakeStats();
+			uint64_t total = st.full + st.resumed;
+
+			LOG_INFO("OpenSSLManager: {} TLS handshakes, {} full | {} resumed ({:.1f}% resumed).", total, st.full, st.resumed, total ? (100.0 * st.resumed / total) : 0.0);
+
+			if (s_externalCache)
+			{
+				LOG_INFO("OpenSSLManager: external session cache ({}), {} hits | {} misses.", s_externalCache->GetName(), s_externalCacheHits.load(std::memory_order_relaxed), s_externalCacheMisses.load(std::memory_order_relaxed));
+				s_externalCache->LogStats();
+			}
+
+			if (s_ktlsEnabled)
+			{
+				LOG_INFO("OpenSSLManager: kTLS offloaded {} of {} sessions (send) | {} (receive).", st.ktlsSend, total, st.ktlsRecv);
+			}
+		}
+
 		static int ServerShutdown()
 		{
 			SSL_CTX_free(s_server_ctx);
@@ -0,0 +1,338 @@
+#include "SharedMemorySessionCache.h"
+
+#include "ConsoleLogger.h"
+#include "FileLogger.h"
+
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <thread>
+
+#ifndef _WIN32
+	#include <fcntl.h>
+	#include <signal.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+namespace NECRO
+{
+	SharedMemorySessionCache::~SharedMemorySessionCache()
+	{
+		Close();
+	}
+
+	int SharedMemorySessionCache::Open(const std::string& name, uint32_t bucketCount)
+	{
+		if (IsOpen() || bucketCount == 0)
+			return -1;
+
+		m_name = name;
+		m_pid = GetCurrentPid();
+		m_size = sizeof(Header) + static_cast<size_t>(bucketCount) * sizeof(Bucket);
+		bool created = false;
+
+#ifdef _WIN32
+		std::string mappingName = "Local\\NECRO_" + name;
+
+		m_mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, static_cast<DWORD>(static_cast<uint64_t>(m_size) >> 32), static_cast<DWORD>(m_size & 0xFFFFFFFF), mappingName.c_str());
+		if (m_mapping == NULL)
+		{
+			LOG_ERROR("SharedMemorySessionCache: could not create the mapping {}. Error: {}", mappingName, GetLastError());
+			return -2;
+		}
+
+		created = (GetLastError() != ERROR_ALREADY_EXISTS);
+
+		m_base = MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, m_size);
+		if (m_base == nullptr)
+		{
+			LOG_ERROR("SharedMemorySessionCache: could not map {}. Error: {}", mappingName, GetLastError());
+			CloseHandle(m_mapping);
+			m_mapping = NULL;
+			return -3;
+		}
+#else
+		std::string shmName = "/" + name;
+
+		int fd = shm_open(shmName.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+		if (fd >= 0)
+		{
+			created = true;
+
+			// ftruncate zero-fills the segment: every lock starts released and every slot empty
+			if (ftruncate(fd, static_cast<off_t>(m_size)) != 0)
+			{
+				LOG_ERROR("SharedMemorySessionCache: could not size {}. Error: {}", shmName, errno);
+				close(fd);
+				shm_unlink(shmName.c_str());
+				return -2;
+			}
+		}
+		else
+		{
+			fd = shm_open(shmName.c_str(), O_RDWR, 0600);
+			if (fd < 0)
+			{
+				LOG_ERROR("SharedMemorySessionCache: could not open {}. Error: {}", shmName, errno);
+				return -2;
+			}
+
+			// The creator may still be sizing it
+			struct stat st;
+			int tries = 0;
+			while (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) < m_size && tries++ < 1000)
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+			if (static_cast<size_t>(st.st_size) != m_size)
+			{
+				LOG_ERROR("SharedMemorySessionCache: {} has a different size than expected, was it created with another bucket count?", shmName);
+				close(fd);
+				return -4;
+			}
+		}
+
+		m_base = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+
+		if (m_base == MAP_FAILED)
+		{
+			m_base = nullptr;
+			LOG_ERROR("SharedMemorySessionCache: could not map {}. Error: {}", shmName, errno);
+			return -3;
+		}
+#endif
+
+		m_header = static_cast<Header*>(m_base);
+		m_buckets = reinterpret_cast<Bucket*>(static_cast<uint8_t*>(m_base) + sizeof(Header));
+		m_bucketCount = bucketCount;
+
+		if (created)
+		{
+			m_header->magic = SHM_MAGIC;
+			m_header->version = SHM_VERSION;
+			m_header->bucketCount = bucketCount;
+			m_header->slotWays = SLOT_WAYS;
+			m_header->maxDer = static_cast<uint32_t>(MAX_SESSION_DER);
+			m_header->ready.store(1, std::memory_order_release);
+		}
+		else
+		{
+			int tries = 0;
+			while (m_header->ready.load(std::memory_order_acquire) == 0 && tries++ < 1000)
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+			if (m_header->ready.load(std::memory_order_acquire) == 0 || m_header->magic != SHM_MAGIC || m_header->version != SHM_VERSION ||
+				m_header->bucketCount != bucketCount || m_header->slotWays != SLOT_WAYS || m_header->maxDer != MAX_SESSION_DER)
+			{
+				LOG_ERROR("SharedMemorySessionCache: {} has an incompatible layout.", name);
+				Close();
+				return -4;
+			}
+		}
+
+		LOG_OK("SharedMemorySessionCache: {} {} ({} sessions).", created ? "created" : "attached to", name, static_cast<size_t>(bucketCount) * SLOT_WAYS);
+		return 0;
+	}
+
+	//-----------------------------------------------------------------------------------------------------
+	// Detaches from the segment. The segment itself is left for the other processes (and the next run)
+	//-----------------------------------------------------------------------------------------------------
+	void SharedMemorySessionCache::Close()
+	{
+		if (!m_base)
+			return;
+
+#ifdef _WIN32
+		UnmapViewOfFile(m_base);
+		CloseHandle(m_mapping);
+		m_mapping = NULL;
+#else
+		munmap(m_base, m_size);
+#endif
+
+		m_base = nullptr;
+		m_header = nullptr;
+		m_buckets = nullptr;
+		m_bucketCount = 0;
+	}
+
+	SharedMemorySessionCache::Bucket* SharedMemorySessionCache::GetBucket(const uint8_t* id, size_t idLen)
+	{
+		// FNV-1a, session IDs are random already
+		uint64_t h = 14695981039346656037ull;
+		for (size_t i = 0; i < idLen; i++)
+		{
+			h ^= id[i];
+			h *= 1099511628211ull;
+		}
+
+		return &m_buckets[h % m_bucketCount];
+	}
+
+	uint32_t SharedMemorySessionCache::GetCurrentPid()
+	{
+#ifdef _WIN32
+		return static_cast<uint32_t>(GetCurrentProcessId());
+#else
+		return static_cast<uint32_t>(getpid());
+#endif
+	}
+
+	bool SharedMemorySessionCache::IsProcessAlive(uint32_t pid)
+	{
+#ifdef _WIN32
+		HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, static_cast<DWORD>(pid));
+		if (process == NULL)
+			return GetLastError() != ERROR_INVALID_PARAMETER;
+
+		bool alive = WaitForSingleObject(process, 0) == WAIT_TIMEOUT;
+		CloseHandle(process);
+		return alive;
+#else
+		// EPERM means it exists but belongs to someone else
+		return kill(static_cast<pid_t>(pid), 0) == 0 || errno != ESRCH;
+#endif
+	}
+
+	//-----------------------------------------------------------------------------------------------------
+	// Spins for a little while, then checks the owner: if it died holding the lock the bucket is taken over,
+	// otherwise we give up and the caller treats it as a miss. Every thread of a process has the same pid,
+	// so an owner with our pid is always alive
+	//-----------------------------------------------------------------------------------------------------
+	bool SharedMemorySessionCache::LockBucket(Bucket* b)
+	{
+		for (int i = 0; i < LOCK_MAX_SPINS; i++)
+		{
+			uint32_t expected = 0;
+			if (b->lock.compare_exchange_weak(expected, m_pid, std::memory_order_acquire, std::memory_order_relaxed))
+				return true;
+
+			if ((i & 63) == 63)
+				std::this_thread::yield();
+		}
+
+		uint32_t owner = b->lock.load(std::memory_order_relaxed);
+
+		if (owner != 0 && owner != m_pid && !IsProcessAlive(owner) &&
+			b->lock.compare_exchange_strong(owner, m_pid, std::memory_order_acquire, std::memory_order_relaxed))
+		{
+			// The owner may have died halfway through writing a slot, none of them can be trusted
+			for (Slot& s : b->slots)
+				s.idLen = 0;
+
+			m_lockTakeovers.fetch_add(1, std::memory_order_relaxed);
+			return true;
+		}
+
+		m_lockFailures.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+
+	void SharedMemorySessionCache::UnlockBucket(Bucket* b)
+	{
+		b->lock.store(0, std::memory_order_release);
+	}
+
+	void SharedMemorySessionCache::LogStats() const
+	{
+		LOG_INFO("SharedMemorySessionCache: {} operations gave up on a busy bucket, {} buckets taken over from a dead process.", m_lockFailures.load(std::memory_order_relaxed), m_lockTakeovers.load(std::memory_order_relaxed));
+	}
+
+	bool SharedMemorySessionCache::Store(const uint8_t* id, size_t idLen, const uint8_t* der, size_t derLen, std::time_t expiresAt)
+	{
+		if (!IsOpen() || idLen == 0 || idLen > MAX_SESSION_ID || derLen > MAX_SESSION_DER)
+			return false;
+
+		Bucket* b = GetBucket(id, idLen);
+		if (!LockBucket(b))
+			return false;
+
+		std::time_t now = std::time(nullptr);
+
+		// Same ID, an empty/expired slot, or else the oldest one
+		Slot* match = nullptr;
+		Slot* freeSlot = nullptr;
+		Slot* oldest = nullptr;
+		for (Slot& s : b->slots)
+		{
+			if (s.idLen == idLen && std::memcmp(s.id, id, idLen) == 0)
+			{
+				match = &s;
+				break;
+			}
+
+			if (s.idLen == 0 || s.expiresAt <= now)
+			{
+				if (!freeSlot)
+					freeSlot = &s;
+			}
+			else if (!oldest || s.storedSeq < oldest->storedSeq)
+				oldest = &s;
+		}
+
+		Slot* target = match ? match : (freeSlot ? freeSlot : oldest);
+
+		target->idLen = static_cast<uint8_t>(idLen);
+		std::memcpy(target->id, id, idLen);
+		target->derLen = static_cast<uint16_t>(derLen);
+		std::memcpy(target->der, der, derLen);
+		target->expiresAt = expiresAt;
+		target->storedSeq = m_header->seq.fetch_add(1, std::memory_order_relaxed);
+
+		UnlockBucket(b);
+		return true;
+	}
+
+	bool SharedMemorySessionCache::Fetch(const uint8_t* id, size_t idLen, std::vector<uint8_t>& der)
+	{
+		if (!IsOpen() || idLen == 0 || idLen > MAX_SESSION_ID)
+			return false;
+
+		Bucket* b = GetBucket(id, idLen);
+		if (!LockBucket(b))
+			return false;
+
+		bool found = false;
+		for (Slot& s : b->slots)
+		{
+			if (s.idLen != idLen || std::memcmp(s.id, id, idLen) != 0)
+				continue;
+
+			if (s.expiresAt > std::time(nullptr))
+			{
+				der.assign(s.der, s.der + s.derLen);
+				found = true;
+			}
+			else
+				s.idLen = 0; // expired, free the slot
+
+			break;
+		}
+
+		UnlockBucket(b);
+		return found;
+	}
+
+	void SharedMemorySessionCache::Remove(const uint8_t* id, size_t idLen)
+	{
+		if (!IsOpen() || idLen == 0 || idLen > MAX_SESSION_ID)
+			return;
+
+		Bucket* b = GetBucket(id, idLen);
+		if (!LockBucket(b))
+			return;
+
+		for (Slot& s : b->slots)
+		{
+			if (s.idLen == idLen && std::memcmp(s.id, id, idLen) == 0)
+			{
+				s.idLen = 0;
+				break;
+			}
+		}
+
+		UnlockBucket(b);
+	}
+}
@@ -0,0 +1,113 @@
+#ifndef NECRO_SHARED_MEMORY_SESSION_CACHE_H
+#define NECRO_SHARED_MEMORY_SESSION_CACHE_H
+
+#include "TLSSessionCache.h"
+
+#include <atomic>
+#include <string>
+
+#ifdef _WIN32
+	#include "WinSock2.h"
+	#include <Windows.h>
+#endif
+
+namespace NECRO
+{
+	//-----------------------------------------------------------------------------------------------------
+	// TLSSessionCache backed by a named shared memory segment, shared by the processes of the same host.
+	// The segment is a set-associative table: a session ID hashes to a bucket of SLOT_WAYS slots, each bucket
+	// has its own spinlock so processes only contend when they touch the same bucket. The lock word holds the pid of
+	// the owner, so a bucket left locked by a process that died is taken over (and emptied) by the next one that needs it.
+	// When a bucket is full the oldest session is replaced. Sessions bigger than MAX_SESSION_DER are not cached.
+	//-----------------------------------------------------------------------------------------------------
+	class SharedMemorySessionCache : public TLSSessionCache
+	{
+	public:
+		static constexpr uint32_t DEFAULT_BUCKETS = 2048;
+		static constexpr uint32_t SLOT_WAYS = 4;
+		static constexpr size_t MAX_SESSION_ID = 32;
+		static constexpr size_t MAX_SESSION_DER = 1024;
+
+	private:
+		static constexpr uint32_t SHM_MAGIC = 0x4E544C53; // "NTLS"
+		static constexpr uint32_t SHM_VERSION = 2;
+
+		// Attempts to lock a bucket before checking whether its owner is still alive, and giving up if it is: it's a cache, a miss is fine
+		static constexpr int LOCK_MAX_SPINS = 256;
+
+		struct Slot
+		{
+			std::time_t	expiresAt;
+			uint64_t	storedSeq;
+			uint16_t	derLen;
+			uint8_t		idLen;
+			uint8_t		id[MAX_SESSION_ID];
+			uint8_t		der[MAX_SESSION_DER];
+		};
+
+		struct Bucket
+		{
+			std::atomic<uint32_t>	lock;	// 0 when free, the pid of the owner otherwise
+			uint32_t				pad;
+			Slot					slots[SLOT_WAYS];
+		};
+
+		struct Header
+		{
+			uint32_t				magic;
+			uint32_t				version;
+			uint32_t				bucketCount;
+			uint32_t				slotWays;
+			uint32_t				maxDer;
+			std::atomic<uint32_t>	ready;
+			std::atomic<uint64_t>	seq;
+		};
+
+		static_assert(std::atomic<uint32_t>::is_always_lock_free && std::atomic<uint64_t>::is_always_lock_free, "Shared memory atomics must be lock-free");
+
+		std::string	m_name;
+		void*		m_base = nullptr;
+		size_t		m_size = 0;
+		Header*		m_header = nullptr;
+		Bucket*		m_buckets = nullptr;
+		uint32_t	m_bucketCount = 0;
+		uint32_t	m_pid = 0;
+
+		// Operations that gave up on a busy bucket (counted as misses), and buckets taken over from a dead owner
+		std::atomic<uint64_t>	m_lockFailures{ 0 };
+		std::atomic<uint64_t>	m_lockTakeovers{ 0 };
+
+#ifdef _WIN32
+		HANDLE		m_mapping = NULL;
+#endif
+
+		Bucket*		GetBucket(const uint8_t* id, size_t idLen);
+		bool		LockBucket(Bucket* b);
+		void		UnlockBucket(Bucket* b);
+
+		static uint32_t	GetCurrentPid();
+		static bool		IsProcessAlive(uint32_t pid);
+
+	public:
+		SharedMemorySessionCache() = default;
+		~SharedMemorySessionCache();
+
+		SharedMemorySessionCache(const SharedMemorySessionCache&) = delete;
+		SharedMemorySessionCache& operator=(const SharedMemorySessionCache&) = delete;
+
+		//-----------------------------------------------------------------------------------------------------
+		// Creates the segment, or attaches to it if another process already did. All the processes must use the same bucketCount
+		//-----------------------------------------------------------------------------------------------------
+		int			Open(const std::string& name, uint32_t bucketCount = DEFAULT_BUCKETS);
+		void		Close();
+		bool		IsOpen() const { return m_base != nullptr; }
+
+		const char*	GetName() const override { return "shared memory"; }
+		bool		Store(const uint8_t* id, size_t idLen, const uint8_t* der, size_t derLen, std::time_t expiresAt) override;
+		bool		Fetch(const uint8_t* id, size_t idLen, std::vector<uint8_t>& der) override;
+		void		Remove(const uint8_t* id, size_t idLen) override;
+		void		LogStats() const override;
+	};
+}
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef NECRO_TLS_SESSION_CACHE_H
+#define NECRO_TLS_SESSION_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <vector>
+
+namespace NECRO
+{
+	//-----------------------------------------------------------------------------------------------------
+	// External TLS session cache, plugged in OpenSSL's new/get/remove session callbacks by the OpenSSLManager.
+	// Sessions are stored serialized (DER) by session ID, so a backend can share them between processes:
+	// a client resuming on any node that sees the same backend skips the full handshake.
+	// Implementations are called by every reactor thread and must be thread-safe.
+	//-----------------------------------------------------------------------------------------------------
+	class TLSSessionCache
+	{
+	public:
+		virtual ~TLSSessionCache() = default;
+
+		virtual const char* GetName() const = 0;
+
+		// Stores (or replaces) a session, expiresAt is a wall-clock time (time(nullptr) scale). Returns false if it couldn't be stored
+		virtual bool Store(const uint8_t* id, size_t idLen, const uint8_t* der, size_t derLen, std::time_t expiresAt) = 0;
+
+		// Fills der with the session, returns false if it's missing or expired
+		virtual bool Fetch(const uint8_t* id, size_t idLen, std::vector<uint8_t>& der) = 0;
+
+		virtual void Remove(const uint8_t* id, size_t idLen) = 0;
+
+		// Logs the backend's own counters, if it has any
+		virtual void LogStats() const {}
+	};
+}
+
+#endif
@@ -0,0 +1,167 @@
+#include "BufferPool.h"
+
+#include "ConsoleLogger.h"
+#include "FileLogger.h"
+
+#include <atomic>
+#include <mutex>
+#include <new>
+
+namespace NECRO
+{
+	constexpr size_t BufferPool::CLASS_SIZES[BufferPool::CLASSES_COUNT];
+
+	namespace
+	{
+		struct FreeBlock
+		{
+			FreeBlock* next;
+		};
+
+		// Counters of a single thread, only that thread writes them. They're never freed, so the stats of the threads that exited are kept
+		struct ThreadCounters
+		{
+			std::atomic<uint64_t>	hits{ 0 };
+			std::atomic<uint64_t>	misses{ 0 };
+			std::atomic<uint64_t>	oversize{ 0 };
+			std::atomic<int64_t>	bytesOutstanding{ 0 };
+			std::atomic<uint64_t>	slabBytes{ 0 };
+		};
+
+		// Registry of every thread's counters and of every slab, slabs are only allocated on a miss so the lock is off the hot path
+		// They're never destroyed, threads may still release buffers while the statics are being torn down
+		std::mutex						g_registryMutex;
+		std::vector<ThreadCounters*>&	g_counters = *new std::vector<ThreadCounters*>();
+		std::vector<void*>&				g_slabs = *new std::vector<void*>();
+
+		struct ThreadCache
+		{
+			FreeBlock*		freeLists[BufferPool::CLASSES_COUNT] = {};
+			ThreadCounters*	counters;
+
+			ThreadCache()
+			{
+				counters = new ThreadCounters();
+
+				std::lock_guard<std::mutex> lock(g_registryMutex);
+				g_counters.push_back(counters);
+			}
+		};
+
+		thread_local ThreadCache t_cache;
+
+		int GetClass(size_t size)
+		{
+			for (size_t i = 0; i < BufferPool::CLASSES_COUNT; i++)
+				if (size <= BufferPool::CLASS_SIZES[i])
+					return static_cast<int>(i);
+
+			return -1;
+		}
+
+		void Increment(std::atomic<uint64_t>& c, uint64_t v = 1)
+		{
+			// Single writer, no need for an atomic RMW
+			c.store(c.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+		}
+
+		void Add(std::atomic<int64_t>& c, int64_t v)
+		{
+			c.store(c.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+		}
+	}
+
+	void* BufferPool::Allocate(size_t size)
+	{
+		ThreadCache& cache = t_cache;
+		int cls = GetClass(size);
+
+		if (cls < 0)
+		{
+			Increment(cache.counters->oversize);
+			Add(cache.counters->bytesOutstanding, static_cast<int64_t>(size));
+			return ::operator new(size);
+		}
+
+		size_t blockSize = CLASS_SIZES[cls];
+
+		if (cache.freeLists[cls])
+		{
+			Increment(cache.counters->hits);
+		}
+		else
+		{
+			// Carve a new slab in blocks of this class
+			Increment(cache.counters->misses);
+			Increment(cache.counters->slabBytes, SLAB_SIZE);
+
+			uint8_t* slab = static_cast<uint8_t*>(::operator new(SLAB_SIZE));
+			{
+				std::lock_guard<std::mutex> lock(g_registryMutex);
+				g_slabs.push_back(slab);
+			}
+
+			for (size_t off = 0; off + blockSize <= SLAB_SIZE; off += blockSize)
+			{
+				FreeBlock* b = reinterpret_cast<FreeBlock*>(slab + off);
+				b->next = cache.freeLists[cls];
+				cache.freeLists[cls] = b;
+			}
+		}
+
+		FreeBlock* b = cache.freeLists[cls];
+		cache.freeLists[cls] = b->next;
+
+		Add(cache.counters->bytesOutstanding, static_cast<int64_t>(blockSize));
+		return b;
+	}
+
+	void BufferPool::Deallocate(void* p, size_t size) noexcept
+	{
+		if (!p)
+			return;
+
+		ThreadCache& cache = t_cache;
+		int cls = GetClass(size);
+
+		if (cls < 0)
+		{
+			Add(cache.counters->bytesOutstanding, -static_cast<int64_t>(size));
+			::operator delete(p);
+			return;
+		}
+
+		FreeBlock* b = static_cast<FreeBlock*>(p);
+		b->next = cache.freeLists[cls];
+		cache.freeLists[cls] = b;
+
+		Add(cache.counters->bytesOutstanding, -static_cast<int64_t>(CLASS_SIZES[cls]));
+	}
+
+	BufferPool::Stats BufferPool::GetStats()
+	{
+		Stats s{};
+
+		std::lock_guard<std::mutex> lock(g_registryMutex);
+		for (ThreadCounters* c : g_counters)
+		{
+			s.hits += c->hits.load(std::memory_order_relaxed);
+			s.misses += c->misses.load(std::memory_order_relaxed);
+			s.oversize += c->oversize.load(std::memory_order_relaxed);
+			s.bytesOutstanding += c->bytesOutstanding.load(std::memory_order_relaxed);
+			s.slabBytes += c->slabBytes.load(std::memory_order_relaxed);
+		}
+
+		return s;
+	}
+
+	void BufferPool::LogStats()
+	{
+		Stats s = GetStats();
+
+		uint64_t requests = s.hits + s.misses + s.oversize;
+		double hitRate = requests > 0 ? (100.0 * s.hits) / requests : 0.0;
+
+		LOG_INFO("BufferPool: hit rate {:.1f}% ({} hits, {} misses, {} oversize) | {} bytes outstanding | {} bytes in slabs", hitRate, s.hits, s.misses, s.oversize, s.bytesOutstanding, s.slabBytes);
+	}
+}
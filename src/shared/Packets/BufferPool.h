@@ -0,0 +1,74 @@
+#ifndef NECRO_BUFFER_POOL_H
+#define NECRO_BUFFER_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace NECRO
+{
+	//-----------------------------------------------------------------------------------------------------
+	// Size-classed pool that backs the storage of Packets and NetworkMessages.
+	// Every thread carves its blocks out of its own slabs and keeps its own free lists, so allocating and
+	// releasing a buffer is a pointer pop/push with no locks. A block released by another thread simply
+	// joins that thread's free list. Slabs are kept for the whole life of the process.
+	// Requests bigger than the biggest class go to the regular heap.
+	//-----------------------------------------------------------------------------------------------------
+	class BufferPool
+	{
+	public:
+		static constexpr size_t CLASSES_COUNT = 3;
+		static constexpr size_t CLASS_SIZES[CLASSES_COUNT] = { 64, 256, 4096 };
+		static constexpr size_t SLAB_SIZE = 64 * 1024;
+
+		struct Stats
+		{
+			uint64_t	hits;				// served from a free list
+			uint64_t	misses;				// needed a new slab
+			uint64_t	oversize;			// bigger than the biggest class, served by the heap
+			int64_t		bytesOutstanding;	// currently handed out (by class size)
+			uint64_t	slabBytes;			// memory reserved by the slabs
+		};
+
+		static void*	Allocate(size_t size);
+		static void		Deallocate(void* p, size_t size) noexcept;
+
+		static Stats	GetStats();
+		static void		LogStats();
+	};
+
+	//-----------------------------------------------------------------------------------------------------
+	// Standard allocator over the BufferPool, so containers can use it directly
+	//-----------------------------------------------------------------------------------------------------
+	template<typename T>
+	struct PoolAllocator
+	{
+		typedef T value_type;
+
+		PoolAllocator() noexcept = default;
+
+		template<typename U>
+		PoolAllocator(const PoolAllocator<U>&) noexcept {}
+
+		T* allocate(size_t n)
+		{
+			return static_cast<T*>(BufferPool::Allocate(n * sizeof(T)));
+		}
+
+		void deallocate(T* p, size_t n) noexcept
+		{
+			BufferPool::Deallocate(p, n * sizeof(T));
+		}
+	};
+
+	template<typename T, typename U>
+	bool operator==(const PoolAllocator<T>&, const PoolAllocator<U>&) { return true; }
+
+	template<typename T, typename U>
+	bool operator!=(const PoolAllocator<T>&, const PoolAllocator<U>&) { return false; }
+
+	// Byte buffer used by Packet and NetworkMessage
+	typedef std::vector<uint8_t, PoolAllocator<uint8_t>> PooledBuffer;
+}
+
+#endif
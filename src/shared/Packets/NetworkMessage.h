@@ -1,6 +1,7 @@
 #ifndef NETWORK_MESSAGE_H
 #define NETWORK_MESSAGE_H
 
+#include <iterator>
 #include <vector>
 
 #include "Packet.h"
@@ -19,20 +20,15 @@ namespace NECRO
         // ReadPos in the NetworkMessage can be viewed as "consumed" pos, 
         // if it's > 0 it means we've consumed the data until there, so it's probably a good idea to move the remaining data at beginning of the buffer with CompactData()
 
-        std::vector<uint8_t>    m_data;          // Raw Data
-        std::vector<uint8_t>    m_cipherData;    // Data after being encrpyted/decrypted
-        unsigned char           m_tag[GCM_TAG_SIZE];
+        PooledBuffer            m_data;          // Raw Data, from the BufferPool
 
     public:
         // Move constructor
         NetworkMessage(NetworkMessage&& other) noexcept :
             m_rpos(other.m_rpos),
             m_wpos(other.m_wpos),
-            m_data(std::move(other.m_data)),                // Move the vector
-            m_cipherData(std::move(other.m_cipherData))     // Move the vector
+            m_data(std::move(other.m_data))     // Move the vector
         {
-            // Copy the tag array
-            std::memcpy(m_tag, other.m_tag, GCM_TAG_SIZE);
         }
 
         // NetworkMessage Constructor
@@ -47,13 +43,19 @@ namespace NECRO
             m_data.resize(reservedSize);
         }
 
-        // Wraps a packet in a NetworkMessage
-        NetworkMessage(const Packet& p)
+        // Wraps a packet in a NetworkMessage, copying it
+        NetworkMessage(const Packet& p) : m_rpos(0), m_wpos(0)
         {
             m_data.resize(p.Size());
             Write(p.GetContentToRead(), p.Size());
         }
 
+        // Wraps a packet in a NetworkMessage, adopting its storage (no copy). The packet is left empty
+        NetworkMessage(Packet&& p) : m_rpos(0), m_data(p.ReleaseData())
+        {
+            m_wpos = m_data.size();
+        }
+
         //-----------------------------------------------------------------------------------------------------------
         // Clears data array and write/read pos
         //-----------------------------------------------------------------------------------------------------------
@@ -83,71 +85,280 @@ namespace NECRO
         size_t GetActiveSize() const { return m_wpos - m_rpos; }
         size_t GetRemainingSpace() const { return m_data.size() - m_wpos; }
 
-        // Encrpytion
+        //-----------------------------------------------------------------------------------------------------------------
+        // Encryption
+        // Encrypted messages are framed as [PCKT_SIZE | IV | TAG | CIPHERTEXT], and both directions work in place:
+        // the payload is encrypted where it sits with the header written in front of it, and decrypted plaintext
+        // is left where the ciphertext was.
+        // A batched frame (AES_BATCH_FLAG set in PCKT_SIZE) carries several messages sealed together, its plaintext is
+        // [COUNT (u16) | LEN_0 (u32) ... LEN_N-1 (u32) | MSG_0 ... MSG_N-1] and its PCKT_SIZE is authenticated as AAD.
+        //-----------------------------------------------------------------------------------------------------------------
+        static constexpr size_t AES_HEADER_SIZE = sizeof(uint32_t) + GCM_IV_SIZE + GCM_TAG_SIZE;
+        static constexpr uint32_t AES_BATCH_FLAG = 0x80000000u;
+        static constexpr size_t AES_BATCH_MAX_MESSAGES = 0xFFFF;
+
+        // Plaintext of a frame decrypted in place, pointing inside the buffer the frame was in
+        struct DecryptedFrame
+        {
+            uint8_t* data = nullptr;
+            size_t size = 0;
+            size_t frameSize = 0;   // bytes the whole frame took in the buffer, to consume after handling the plaintext
+            bool batched = false;   // plaintext is a batch, split it with ForEachBatchedMessage
+        };
+
+        //-----------------------------------------------------------------------------------------------------------------
+        // Leaves room for the AES header in front of the payload, so AESEncrypt doesn't have to move it. Call on an empty message, before writing
+        //-----------------------------------------------------------------------------------------------------------------
+        void ReserveCipherHeader()
+        {
+            if (m_data.size() < AES_HEADER_SIZE)
+                m_data.resize(AES_HEADER_SIZE);
+
+            m_rpos = m_wpos = AES_HEADER_SIZE;
+        }
+
         int AESEncrypt(unsigned char* key, AES::IV& iv, unsigned char* aad, int aadLen)
+        {
+            return EncryptInPlace(iv, aad, aadLen, false, [&](unsigned char* ivBytes, unsigned char* data, int len, unsigned char* tag, unsigned char* aadPtr, int aadPtrLen)
+                {
+                    return AES::Encrypt(data, len, aadPtr, aadPtrLen, key, ivBytes, GCM_IV_SIZE, data, tag);
+                });
+        }
+
+        // Same as above, with the session's pre-keyed contexts (no per-message EVP_CIPHER_CTX setup)
+        int AESEncrypt(AES::SessionCipher& cipher, AES::IV& iv, unsigned char* aad, int aadLen)
+        {
+            return EncryptInPlace(iv, aad, aadLen, false, [&](unsigned char* ivBytes, unsigned char* data, int len, unsigned char* tag, unsigned char* aadPtr, int aadPtrLen)
+                {
+                    return cipher.Encrypt(data, len, aadPtr, aadPtrLen, ivBytes, data, tag);
+                });
+        }
+
+        //-----------------------------------------------------------------------------------------------------------------
+        // Fills this (empty) message with the messages in [begin, end) sealed as a single batched frame: one IV, one tag.
+        // Returns the ciphertext length, -1 on failure
+        //-----------------------------------------------------------------------------------------------------------------
+        template<typename It>
+        int AESSealBatch(AES::SessionCipher& cipher, AES::IV& iv, It begin, It end)
+        {
+            size_t count = static_cast<size_t>(std::distance(begin, end));
+            if (count == 0 || count > AES_BATCH_MAX_MESSAGES)
+                return -1;
+
+            ReserveCipherHeader();
+
+            // Index
+            uint16_t netCount = htons(static_cast<uint16_t>(count));
+            Write(&netCount, sizeof(netCount));
+
+            for (It it = begin; it != end; ++it)
+            {
+                uint32_t len = htonl(static_cast<uint32_t>(it->GetActiveSize()));
+                Write(&len, sizeof(len));
+            }
+
+            // Messages
+            for (It it = begin; it != end; ++it)
+                Write(it->GetReadPointer(), it->GetActiveSize());
+
+            return EncryptInPlace(iv, nullptr, 0, true, [&](unsigned char* ivBytes, unsigned char* data, int len, unsigned char* tag, unsigned char* aadPtr, int aadPtrLen)
+                {
+                    return cipher.Encrypt(data, len, aadPtr, aadPtrLen, ivBytes, data, tag);
+                });
+        }
+
+        //-----------------------------------------------------------------------------------------------------------------
+        // Calls f(index, data, size) for every message of a decrypted batched frame, in the order they were queued.
+        // Returns the number of messages, -2 if the index is malformed
+        //-----------------------------------------------------------------------------------------------------------------
+        template<typename F>
+        static int ForEachBatchedMessage(const DecryptedFrame& frame, F&& f)
+        {
+            if (!frame.batched || frame.size < sizeof(uint16_t))
+                return -2;
+
+            uint16_t count;
+            std::memcpy(&count, frame.data, sizeof(count));
+            count = ntohs(count);
+
+            size_t indexSize = sizeof(uint16_t) + static_cast<size_t>(count) * sizeof(uint32_t);
+            if (frame.size < indexSize)
+                return -2;
+
+            // Validate the whole index before handing out anything
+            size_t total = indexSize;
+            for (uint16_t i = 0; i < count; i++)
+            {
+                uint32_t len;
+                std::memcpy(&len, frame.data + sizeof(uint16_t) + i * sizeof(uint32_t), sizeof(len));
+                total += ntohl(len);
+            }
+
+            if (total != frame.size)
+                return -2;
+
+            const uint8_t* msg = frame.data + indexSize;
+            for (uint16_t i = 0; i < count; i++)
+            {
+                uint32_t len;
+                std::memcpy(&len, frame.data + sizeof(uint16_t) + i * sizeof(uint32_t), sizeof(len));
+                len = ntohl(len);
+
+                f(i, msg, static_cast<size_t>(len));
+                msg += len;
+            }
+
+            return count;
+        }
+
+        //-----------------------------------------------------------------------------------------------------------------
+        // Decrypts the frame at the read pos, then the message only exposes its plaintext.
+        // Returns the plaintext length, -1 if the frame isn't complete yet, -2 if it's malformed, -3 if it doesn't authenticate
+        //-----------------------------------------------------------------------------------------------------------------
+        int AESDecrypt(unsigned char* key, unsigned char* aad, int aadLen)
+        {
+            DecryptedFrame frame;
+            int ret = DecryptFrameInPlace(GetReadPointer(), GetActiveSize(), aad, aadLen, frame, [&](unsigned char* ivPtr, unsigned char* tagPtr, unsigned char* data, int len, unsigned char* aadPtr, int aadPtrLen)
+                {
+                    return AES::Decrypt(data, len, aadPtr, aadPtrLen, tagPtr, key, ivPtr, GCM_IV_SIZE, data);
+                });
+
+            if (ret >= 0)
+                ExposePlaintext(frame);
+
+            return ret;
+        }
+
+        int AESDecrypt(AES::SessionCipher& cipher, unsigned char* aad, int aadLen)
+        {
+            DecryptedFrame frame;
+            int ret = AESDecryptFrame(cipher, GetReadPointer(), GetActiveSize(), aad, aadLen, frame);
+
+            if (ret >= 0)
+                ExposePlaintext(frame);
+
+            return ret;
+        }
+
+        //-----------------------------------------------------------------------------------------------------------------
+        // Decrypts the frame at the beginning of 'data' (e.g. the read pointer of a RecvBuffer) without copying it anywhere.
+        // On success 'out' points at the plaintext inside 'data', the caller consumes out.frameSize bytes once done with it.
+        // Same return values as AESDecrypt
+        //-----------------------------------------------------------------------------------------------------------------
+        static int AESDecryptFrame(AES::SessionCipher& cipher, uint8_t* data, size_t available, unsigned char* aad, int aadLen, DecryptedFrame& out)
+        {
+            return DecryptFrameInPlace(data, available, aad, aadLen, out, [&](unsigned char* ivPtr, unsigned char* tagPtr, unsigned char* cipherData, int len, unsigned char* aadPtr, int aadPtrLen)
+                {
+                    return cipher.Decrypt(cipherData, len, aadPtr, aadPtrLen, tagPtr, ivPtr, cipherData);
+                });
+        }
+
+    private:
+        template<typename EncryptFunc>
+        int EncryptInPlace(AES::IV& iv, unsigned char* aad, int aadLen, bool batched, EncryptFunc&& encrypt)
         {
             // Write the iv as bytes
             std::array<uint8_t, GCM_IV_SIZE> ivBytes;
             iv.ToByteArray(ivBytes);
             iv.IncrementCounter(); // increment counter here! So we are sure each encrypt operation increases the counter
 
-            // Transform the data in this message to the encrypted equivalend, format [PCKT_SIZE | IV | TAG | CIPHERTEXT]
-            m_cipherData.resize(GetActiveSize());  // same as plaintext, since GCM shouldn't expand
-            int ciphertext_len = AES::Encrypt(GetReadPointer(), GetActiveSize(), aad, aadLen, key, ivBytes.data(), GCM_IV_SIZE, m_cipherData.data(), m_tag);
+            size_t payloadLen = GetActiveSize();
 
-            if (ciphertext_len >= 0)
+            // No room was reserved for the header, move the payload forward once (in this same buffer)
+            if (m_rpos < AES_HEADER_SIZE)
             {
-                SoftClear();
+                size_t shift = AES_HEADER_SIZE - m_rpos;
+
+                if (m_data.size() < m_wpos + shift)
+                    m_data.resize(m_wpos + shift);
 
-                uint32_t packetSize = GCM_IV_SIZE + GCM_TAG_SIZE + ciphertext_len;
-                packetSize = htonl(packetSize);
+                std::memmove(GetBasePointer() + AES_HEADER_SIZE, GetReadPointer(), payloadLen);
+                m_rpos = AES_HEADER_SIZE;
+                m_wpos = m_rpos + payloadLen;
+            }
 
-                Write(&packetSize, sizeof(packetSize)); // write the whole packet size as first uint32_t
-                Write(ivBytes.data(), GCM_IV_SIZE);
-                Write(m_tag, GCM_TAG_SIZE);
-                Write(m_cipherData.data(), ciphertext_len);
+            uint8_t* header = GetReadPointer() - AES_HEADER_SIZE;
 
-                return ciphertext_len;
+            // GCM doesn't expand, so the size is known before encrypting
+            uint32_t packetSize = static_cast<uint32_t>(GCM_IV_SIZE + GCM_TAG_SIZE + payloadLen);
+            if (batched)
+                packetSize |= AES_BATCH_FLAG;
+            packetSize = htonl(packetSize);
+
+            std::memcpy(header, &packetSize, sizeof(packetSize)); // the whole packet size as first uint32_t
+            std::memcpy(header + sizeof(packetSize), ivBytes.data(), GCM_IV_SIZE);
+
+            // A batched frame authenticates its size word, so the flag can't be flipped in transit
+            if (batched)
+            {
+                aad = header;
+                aadLen = sizeof(packetSize);
             }
-            else
+
+            // The ciphertext takes the place of the plaintext and the tag goes straight in the header
+            int ciphertext_len = encrypt(ivBytes.data(), GetReadPointer(), static_cast<int>(payloadLen), header + sizeof(uint32_t) + GCM_IV_SIZE, aad, aadLen);
+
+            if (ciphertext_len < 0)
                 return -1;
+
+            m_rpos -= AES_HEADER_SIZE;
+            m_wpos = m_rpos + AES_HEADER_SIZE + ciphertext_len;
+
+            return ciphertext_len;
         }
 
-        int AESDecrypt(unsigned char* key, unsigned char* aad, int aadLen)
+        template<typename DecryptFunc>
+        static int DecryptFrameInPlace(uint8_t* data, size_t available, unsigned char* aad, int aadLen, DecryptedFrame& out, DecryptFunc&& decrypt)
         {
-            if (GetActiveSize() < sizeof(uint32_t)) // not enough data to event start decrypting
+            if (available < sizeof(uint32_t)) // not enough data to event start decrypting
                 return -1;
 
             uint32_t packetSize;
-            std::memcpy(&packetSize, GetReadPointer(), sizeof(uint32_t));
+            std::memcpy(&packetSize, data, sizeof(uint32_t));
             packetSize = ntohl(packetSize); // Convert from network to host byte order
 
-            if (GetActiveSize() < sizeof(uint32_t) + packetSize)
-                return -1; // not enough data to event start decrypting
+            bool batched = (packetSize & AES_BATCH_FLAG) != 0;
+            packetSize &= ~AES_BATCH_FLAG;
 
-            // Read packet [PCKT_SIZE | IV | TAG | CIPHERTEXT]
-            unsigned char* ivPtr = GetReadPointer() + sizeof(packetSize);
-            unsigned char* tagPtr = GetReadPointer() + sizeof(packetSize) + GCM_IV_SIZE;
-            unsigned char* cipherPtr = GetReadPointer() + sizeof(packetSize) + GCM_IV_SIZE + GCM_TAG_SIZE;
-            int cipherTextLen = packetSize - (GCM_IV_SIZE + GCM_TAG_SIZE);
+            if (batched)
+            {
+                aad = data;
+                aadLen = sizeof(packetSize);
+            }
 
-            if (cipherTextLen < 0)
+            if (packetSize < GCM_IV_SIZE + GCM_TAG_SIZE)
                 return -2; // malformed packet
 
-            // Decrypt
-            m_cipherData.resize(cipherTextLen);
-            int plainTextLen = AES::Decrypt(cipherPtr, cipherTextLen, aad, aadLen, tagPtr, key, ivPtr, GCM_IV_SIZE, m_cipherData.data());
+            if (available < sizeof(uint32_t) + packetSize)
+                return -1; // not enough data to event start decrypting
+
+            // Read packet [PCKT_SIZE | IV | TAG | CIPHERTEXT]
+            unsigned char* ivPtr = data + sizeof(packetSize);
+            unsigned char* tagPtr = ivPtr + GCM_IV_SIZE;
+            unsigned char* cipherPtr = tagPtr + GCM_TAG_SIZE;
+            int cipherTextLen = static_cast<int>(packetSize - (GCM_IV_SIZE + GCM_TAG_SIZE));
+
+            // Decrypt, the plaintext overwrites the ciphertext
+            int plainTextLen = decrypt(ivPtr, tagPtr, cipherPtr, cipherTextLen, aad, aadLen);
 
             if (plainTextLen < 0)
                 return -3; // decryption failed
 
-            // Replace internal buffer with plaintext
-            SoftClear();
-            Write(m_cipherData.data(), plainTextLen);
+            out.data = cipherPtr;
+            out.size = static_cast<size_t>(plainTextLen);
+            out.frameSize = sizeof(uint32_t) + packetSize;
+            out.batched = batched;
 
             return plainTextLen;
         }
 
+        void ExposePlaintext(const DecryptedFrame& frame)
+        {
+            m_rpos = static_cast<size_t>(frame.data - GetBasePointer());
+            m_wpos = m_rpos + frame.size;
+        }
+
+    public:
         //-----------------------------------------------------------------------------------------------------------------
         // When data will be processed by the socket read handler, it will have to call this function to update the rpos
         //-----------------------------------------------------------------------------------------------------------------
@@ -206,17 +417,6 @@ namespace NECRO
                 m_wpos += size;
             }
         }
-
-        //---------------------------------------------------------------------------------------------------------------------------
-        // Increases the data buffer size by 50% of the current size if it's currently full, useful to the inBuffer of the Sockets,
-        // if done before a read it can avoid having to queue packets
-        //---------------------------------------------------------------------------------------------------------------------------
-        void EnlargeBufferIfNeeded()
-        {
-            if (GetRemainingSpace() == 0)
-                m_data.resize(Size() + (Size() / 2));
-        }
-
     };
 }
 #endif
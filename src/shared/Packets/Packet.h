@@ -3,8 +3,11 @@
 
 #include <vector>
 #include <string>
+#include <cstring>
 #include <stdexcept>
 
+#include "BufferPool.h"
+
 namespace NECRO
 {
     //----------------------------------------------------------------------------------------------------------------
@@ -15,7 +18,7 @@ namespace NECRO
     private:
         size_t                  m_rpos;     // Read Pos
         size_t                  m_wpos;     // Write Pos
-        std::vector<uint8_t>    m_data;     // Raw Data
+        PooledBuffer            m_data;     // Raw Data, from the BufferPool
 
     public:
         constexpr static size_t DEFAULT_PCKT_SIZE = 0x1000;
@@ -58,6 +61,19 @@ namespace NECRO
         size_t  Size()  const { return m_data.size(); }
         bool    Empty() const { return m_data.empty(); }
 
+        //-----------------------------------------------------------------------------------------------------
+        // Gives away the storage (exactly Size() bytes), leaving the packet empty. Used to hand a packet over to a NetworkMessage without copying it
+        //-----------------------------------------------------------------------------------------------------
+        PooledBuffer ReleaseData()
+        {
+            PooledBuffer data(std::move(m_data));
+
+            m_data.clear();
+            m_wpos = m_rpos = 0;
+
+            return data;
+        }
+
 
         // Base append function
         void Append(uint8_t const* src, size_t cnt);
@@ -0,0 +1,181 @@
+#ifndef NECRO_RECV_BUFFER_H
+#define NECRO_RECV_BUFFER_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#include "BufferPool.h"
+
+namespace NECRO
+{
+    //-----------------------------------------------------------------------------------------------------------
+    // Receive buffer of the sockets, a power-of-two ring so received bytes are never shifted around.
+    // It starts small, doubles when full up to a per-connection cap, and goes back to its initial size
+    // when the connection is idle with nothing left to parse.
+    // Readers that need a whole packet contiguous use GetReadPointer(), which only has to move memory
+    // in the (rare) case the unread data wraps around the end of the ring.
+    //-----------------------------------------------------------------------------------------------------------
+    class RecvBuffer
+    {
+    public:
+        static constexpr size_t DEFAULT_INITIAL_CAPACITY = 256;
+        static constexpr size_t DEFAULT_MAX_CAPACITY = 64 * 1024;
+
+    private:
+        PooledBuffer    m_data;
+        size_t          m_head = 0;     // Read Pos, always increasing, masked on access
+        size_t          m_tail = 0;     // Write Pos, always increasing, masked on access
+
+        size_t          m_initialCapacity;
+        size_t          m_maxCapacity;
+
+        static size_t RoundUpPow2(size_t v)
+        {
+            size_t p = 1;
+            while (p < v)
+                p <<= 1;
+            return p;
+        }
+
+        size_t Mask() const { return m_data.size() - 1; }
+
+        //-----------------------------------------------------------------------------------------------------------
+        // Moves the unread data in a buffer of newCapacity bytes, starting at its beginning
+        //-----------------------------------------------------------------------------------------------------------
+        void Reallocate(size_t newCapacity)
+        {
+            PooledBuffer newData(newCapacity);
+            size_t active = GetActiveSize();
+
+            size_t first = 0;
+            const uint8_t* firstPtr = GetReadSpan(first);
+            std::copy(firstPtr, firstPtr + first, newData.begin());
+            std::copy(m_data.begin(), m_data.begin() + (active - first), newData.begin() + first);
+
+            m_data.swap(newData);
+            m_head = 0;
+            m_tail = active;
+        }
+
+    public:
+        RecvBuffer(size_t initialCapacity = DEFAULT_INITIAL_CAPACITY, size_t maxCapacity = DEFAULT_MAX_CAPACITY) :
+            m_initialCapacity(RoundUpPow2(initialCapacity)),
+            m_maxCapacity(RoundUpPow2(std::max(initialCapacity, maxCapacity)))
+        {
+            m_data.resize(m_initialCapacity);
+        }
+
+        size_t  Capacity() const        { return m_data.size(); }
+        size_t  GetMaxCapacity() const  { return m_maxCapacity; }
+        size_t  GetActiveSize() const   { return m_tail - m_head; }
+        bool    Empty() const           { return m_tail == m_head; }
+
+        void SetMaxCapacity(size_t maxCapacity)
+        {
+            m_maxCapacity = RoundUpPow2(std::max(maxCapacity, m_initialCapacity));
+        }
+
+        //-----------------------------------------------------------------------------------------------------------
+        // Discards all the unread data
+        //-----------------------------------------------------------------------------------------------------------
+        void Clear()
+        {
+            m_head = m_tail = 0;
+        }
+
+        //-----------------------------------------------------------------------------------------------------------
+        // Contiguous unread bytes starting at the read position (it may be less than GetActiveSize() if the data wraps)
+        //-----------------------------------------------------------------------------------------------------------
+        const uint8_t* GetReadSpan(size_t& len) const
+        {
+            size_t start = m_head & Mask();
+            len = std::min(GetActiveSize(), m_data.size() - start);
+            return m_data.data() + start;
+        }
+
+        //-----------------------------------------------------------------------------------------------------------
+        // Returns the read position with all the unread data contiguous after it
+        //-----------------------------------------------------------------------------------------------------------
+        uint8_t* GetReadPointer()
+        {
+            size_t start = m_head & Mask();
+
+            // Wrapped, rotate the ring so the unread data starts at the beginning of the storage
+            if (start + GetActiveSize() > m_data.size())
+            {
+                size_t active = GetActiveSize();
+                std::rotate(m_data.begin(), m_data.begin() + start, m_data.end());
+                m_head = 0;
+                m_tail = active;
+                start = 0;
+            }
+
+            return m_data.data() + start;
+        }
+
+        //-----------------------------------------------------------------------------------------------------------
+        // Contiguous free space to receive into, the buffer is grown (up to the cap) if it's full.
+        // Returns len = 0 when the buffer is full and can't grow anymore
+        //-----------------------------------------------------------------------------------------------------------
+        uint8_t* GetWriteSpan(size_t& len)
+        {
+            // Nothing to keep, start from the beginning so the data is less likely to wrap
+            if (Empty())
+                m_head = m_tail = 0;
+
+            if (GetActiveSize() == m_data.size())
+            {
+                if (m_data.size() >= m_maxCapacity)
+                {
+                    len = 0;
+                    return nullptr;
+                }
+
+                Reallocate(std::min(m_data.size() * 2, m_maxCapacity));
+            }
+
+            size_t start = m_tail & Mask();
+            size_t headPos = m_head & Mask();
+
+            // Free space goes up to the read position if it's ahead of us, or to the end of the storage otherwise
+            if (headPos > start)
+                len = headPos - start;
+            else
+                len = m_data.size() - start;
+
+            len = std::min(len, m_data.size() - GetActiveSize());
+            return m_data.data() + start;
+        }
+
+        //-----------------------------------------------------------------------------------------------------------
+        // When data will be processed by the socket read handler, it will have to call this function to update the read pos
+        //-----------------------------------------------------------------------------------------------------------
+        void ReadCompleted(size_t bytes)
+        {
+            m_head += std::min(bytes, GetActiveSize());
+        }
+
+        //-----------------------------------------------------------------------------------------------------------
+        // When data will be written on the buffer by the recv, it will have to call this function to update the write pos
+        //-----------------------------------------------------------------------------------------------------------
+        void WriteCompleted(size_t bytes)
+        {
+            m_tail += bytes;
+        }
+
+        //-----------------------------------------------------------------------------------------------------------
+        // Gives the memory back if the buffer grew and there's nothing left in it, called when the connection has no more data to read
+        //-----------------------------------------------------------------------------------------------------------
+        void ShrinkIfIdle()
+        {
+            if (Empty() && m_data.size() > m_initialCapacity)
+            {
+                PooledBuffer(m_initialCapacity).swap(m_data);
+                m_head = m_tail = 0;
+            }
+        }
+    };
+}
+
+#endif
@@ -5,9 +5,12 @@
 #include "WinSock2.h"
 #else
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #endif
 
 #include <cstdint>
+#include <cstring>
 #include <string>
 
 namespace NECRO
@@ -32,7 +35,7 @@ namespace NECRO
 			memset(ptr, 0, sizeof(*ptr));
 
 			ptr->sin_family = family;
-			ptr->sin_addr.S_un.S_addr = inAddress;
+			ptr->sin_addr.s_addr = inAddress;
 			ptr->sin_port = htons(inPort);
 		}
 
@@ -43,10 +46,11 @@ namespace NECRO
 			memset(ptr, 0, sizeof(*ptr));
 
 			ptr->sin_family = family;
-			ptr->sin_addr.S_un.S_un_b.s_b1 = b1;
-			ptr->sin_addr.S_un.S_un_b.s_b2 = b2;
-			ptr->sin_addr.S_un.S_un_b.s_b3 = b3;
-			ptr->sin_addr.S_un.S_un_b.s_b4 = b4;
+			uint8_t* bytes = reinterpret_cast<uint8_t*>(&ptr->sin_addr.s_addr);
+			bytes[0] = b1;
+			bytes[1] = b2;
+			bytes[2] = b3;
+			bytes[3] = b4;
 			ptr->sin_port = htons(inPort);
 		}
 
@@ -58,7 +62,7 @@ namespace NECRO
 		std::string RemoteAddressAndPortToString() const
 		{
 			const sockaddr_in* addr_in = reinterpret_cast<const sockaddr_in*>(&m_addr);
-			const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&addr_in->sin_addr.S_un.S_addr);
+			const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&addr_in->sin_addr.s_addr);
 
 			std::string result = std::to_string(static_cast<int>(bytes[0])) + "." +
 				std::to_string(static_cast<int>(bytes[1])) + "." +
@@ -72,7 +76,7 @@ namespace NECRO
 		std::string RemoteAddressToString() const
 		{
 			const sockaddr_in* addr_in = reinterpret_cast<const sockaddr_in*>(&m_addr);
-			const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&addr_in->sin_addr.S_un.S_addr);
+			const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&addr_in->sin_addr.s_addr);
 
 			std::string result = std::to_string(static_cast<int>(bytes[0])) + "." +
 				std::to_string(static_cast<int>(bytes[1])) + "." +
@@ -0,0 +1,239 @@
+#include "SocketPoller.h"
+
+#include "ConsoleLogger.h"
+#include "FileLogger.h"
+
+namespace NECRO
+{
+	SocketPoller::Backend SocketPoller::GetDefaultBackend()
+	{
+#ifdef NECRO_HAS_EPOLL
+		return Backend::EPOLL;
+#else
+		return Backend::POLL;
+#endif
+	}
+
+	const char* SocketPoller::GetBackendName(Backend b)
+	{
+		switch (b)
+		{
+		case Backend::POLL:
+			return "poll";
+		case Backend::EPOLL:
+			return "epoll";
+		default:
+			return "unknown";
+		}
+	}
+
+	std::unique_ptr<SocketPoller> SocketPoller::Create(Backend b)
+	{
+		switch (b)
+		{
+#ifdef NECRO_HAS_EPOLL
+		case Backend::EPOLL:
+			return std::make_unique<EpollSocketPoller>();
+#endif
+
+		case Backend::POLL:
+			return std::make_unique<PollSocketPoller>();
+
+		default:
+			LOG_WARNING("SocketPoller: requested backend {} is not available on this platform, falling back to poll.", static_cast<int>(b));
+			return std::make_unique<PollSocketPoller>();
+		}
+	}
+
+	//-----------------------------------------------------------------------------------------------------
+	// PollSocketPoller
+	//-----------------------------------------------------------------------------------------------------
+	int PollSocketPoller::Add(sock_t fd, short events, bool edgeTriggered, void* userData)
+	{
+		if (m_indexOf.find(fd) != m_indexOf.end())
+			return Modify(fd, events, edgeTriggered, userData);
+
+		pollfd pfd;
+		pfd.fd = fd;
+		pfd.events = events;
+		pfd.revents = 0;
+
+		m_indexOf[fd] = m_fds.size();
+		m_fds.push_back(pfd);
+		m_userData.push_back(userData);
+
+		return 0;
+	}
+
+	int PollSocketPoller::Modify(sock_t fd, short events, bool edgeTriggered, void* userData)
+	{
+		auto it = m_indexOf.find(fd);
+		if (it == m_indexOf.end())
+			return -1;
+
+		m_fds[it->second].events = events;
+		m_userData[it->second] = userData;
+
+		return 0;
+	}
+
+	int PollSocketPoller::Remove(sock_t fd)
+	{
+		auto it = m_indexOf.find(fd);
+		if (it == m_indexOf.end())
+			return -1;
+
+		// Swap-and-pop, then fix the index of the element we've moved
+		size_t idx = it->second;
+		size_t last = m_fds.size() - 1;
+
+		if (idx != last)
+		{
+			m_fds[idx] = m_fds[last];
+			m_userData[idx] = m_userData[last];
+			m_indexOf[m_fds[idx].fd] = idx;
+		}
+
+		m_fds.pop_back();
+		m_userData.pop_back();
+		m_indexOf.erase(it);
+
+		return 0;
+	}
+
+	int PollSocketPoller::Wait(std::vector<Event>& out, int timeoutMs)
+	{
+		out.clear();
+
+#ifdef _WIN32
+		int res = WSAPoll(m_fds.data(), static_cast<ULONG>(m_fds.size()), timeoutMs);
+#else
+		int res = poll(m_fds.data(), static_cast<nfds_t>(m_fds.size()), timeoutMs);
+#endif
+
+		if (res <= 0)
+			return res;
+
+		for (size_t i = 0; i < m_fds.size() && static_cast<int>(out.size()) < res; i++)
+		{
+			if (m_fds[i].revents != 0)
+				out.push_back({ m_userData[i], m_fds[i].revents });
+		}
+
+		return static_cast<int>(out.size());
+	}
+
+#ifdef NECRO_HAS_EPOLL
+	//-----------------------------------------------------------------------------------------------------
+	// EpollSocketPoller
+	//-----------------------------------------------------------------------------------------------------
+	static uint32_t ToEpollEvents(short events, bool edgeTriggered)
+	{
+		uint32_t ev = 0;
+
+		if (events & POLLIN)
+			ev |= EPOLLIN;
+		if (events & POLLOUT)
+			ev |= EPOLLOUT;
+		if (edgeTriggered)
+			ev |= EPOLLET;
+
+		return ev;
+	}
+
+	static short FromEpollEvents(uint32_t ev)
+	{
+		short revents = 0;
+
+		if (ev & EPOLLIN)
+			revents |= POLLIN;
+		if (ev & EPOLLOUT)
+			revents |= POLLOUT;
+		if (ev & EPOLLERR)
+			revents |= POLLERR;
+		if (ev & EPOLLHUP)
+			revents |= POLLHUP;
+
+		return revents;
+	}
+
+	EpollSocketPoller::EpollSocketPoller()
+	{
+		m_epfd = epoll_create1(EPOLL_CLOEXEC);
+
+		if (m_epfd < 0)
+		{
+			LOG_ERROR("EpollSocketPoller: epoll_create1() failed [{}]", SocketUtility::GetLastError());
+			throw std::runtime_error("Failed to create the epoll instance.");
+		}
+
+		m_readyEvents.resize(MAX_EVENTS_PER_WAIT);
+	}
+
+	EpollSocketPoller::~EpollSocketPoller()
+	{
+		if (m_epfd >= 0)
+			close(m_epfd);
+	}
+
+	int EpollSocketPoller::Add(sock_t fd, short events, bool edgeTriggered, void* userData)
+	{
+		epoll_event ev{};
+		ev.events = ToEpollEvents(events, edgeTriggered);
+		ev.data.ptr = userData;
+
+		if (epoll_ctl(m_epfd, EPOLL_CTL_ADD, fd, &ev) != 0)
+		{
+			LOG_ERROR("EpollSocketPoller: EPOLL_CTL_ADD failed for fd {} [{}]", fd, SocketUtility::GetLastError());
+			return -1;
+		}
+
+		return 0;
+	}
+
+	int EpollSocketPoller::Modify(sock_t fd, short events, bool edgeTriggered, void* userData)
+	{
+		epoll_event ev{};
+		ev.events = ToEpollEvents(events, edgeTriggered);
+		ev.data.ptr = userData;
+
+		if (epoll_ctl(m_epfd, EPOLL_CTL_MOD, fd, &ev) != 0)
+		{
+			LOG_ERROR("EpollSocketPoller: EPOLL_CTL_MOD failed for fd {} [{}]", fd, SocketUtility::GetLastError());
+			return -1;
+		}
+
+		return 0;
+	}
+
+	int EpollSocketPoller::Remove(sock_t fd)
+	{
+		if (epoll_ctl(m_epfd, EPOLL_CTL_DEL, fd, nullptr) != 0)
+			return -1;
+
+		return 0;
+	}
+
+	int EpollSocketPoller::Wait(std::vector<Event>& out, int timeoutMs)
+	{
+		out.clear();
+
+		int res = epoll_wait(m_epfd, m_readyEvents.data(), static_cast<int>(m_readyEvents.size()), timeoutMs);
+
+		if (res < 0)
+		{
+			// A signal is not an error, treat it as a timeout
+			if (errno == EINTR)
+				return 0;
+
+			return -1;
+		}
+
+		for (int i = 0; i < res; i++)
+			out.push_back({ m_readyEvents[i].data.ptr, FromEpollEvents(m_readyEvents[i].events) });
+
+		return res;
+	}
+#endif
+
+}
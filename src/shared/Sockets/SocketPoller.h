@@ -0,0 +1,113 @@
+#ifndef NECRO_SOCKET_POLLER_H
+#define NECRO_SOCKET_POLLER_H
+
+#include <memory>
+#include <vector>
+#include <unordered_map>
+
+#include "SocketUtility.h"
+
+#ifdef __linux__
+	#define NECRO_HAS_EPOLL 1
+	#include <sys/epoll.h>
+#endif
+
+namespace NECRO
+{
+#ifdef _WIN32
+	typedef SOCKET sock_t;
+#else
+	typedef int sock_t;
+#endif
+
+	//-----------------------------------------------------------------------------------------------------
+	// Readiness notification backend used by the socket managers.
+	// Events are expressed with the usual POLLIN/POLLOUT/POLLERR/POLLHUP/POLLNVAL flags regardless
+	// of the backend, so the code that dispatches them doesn't need to know which one is in use.
+	//-----------------------------------------------------------------------------------------------------
+	class SocketPoller
+	{
+	public:
+		enum class Backend
+		{
+			POLL = 0,	// WSAPoll/poll over a pollfd array, O(n) per wait, available everywhere
+			EPOLL		// epoll, O(ready) per wait, Linux only
+		};
+
+		struct Event
+		{
+			void*	userData;
+			short	revents;
+		};
+
+		virtual ~SocketPoller() = default;
+
+		//-----------------------------------------------------------------------------------------------------
+		// Registers fd for the given events, userData is handed back with every event of this fd.
+		// edgeTriggered is a hint, backends that don't support it deliver level-triggered events, so callers
+		// must always drain the socket until it would block.
+		//-----------------------------------------------------------------------------------------------------
+		virtual int Add(sock_t fd, short events, bool edgeTriggered, void* userData) = 0;
+		virtual int Modify(sock_t fd, short events, bool edgeTriggered, void* userData) = 0;
+		virtual int Remove(sock_t fd) = 0;
+
+		//-----------------------------------------------------------------------------------------------------
+		// Waits up to timeoutMs (-1 = forever) and fills 'out' with the ready fds only.
+		// Returns the number of events, 0 on timeout, -1 on error
+		//-----------------------------------------------------------------------------------------------------
+		virtual int Wait(std::vector<Event>& out, int timeoutMs) = 0;
+
+		virtual Backend GetBackend() const = 0;
+
+		static Backend						GetDefaultBackend();
+		static const char*					GetBackendName(Backend b);
+		static std::unique_ptr<SocketPoller> Create(Backend b);
+	};
+
+	//-----------------------------------------------------------------------------------------------------
+	// WSAPoll/poll backend, keeps a dense pollfd array with swap-and-pop removal
+	//-----------------------------------------------------------------------------------------------------
+	class PollSocketPoller : public SocketPoller
+	{
+	private:
+		std::vector<pollfd>					m_fds;
+		std::vector<void*>					m_userData;	// parallel to m_fds
+		std::unordered_map<sock_t, size_t>	m_indexOf;	// fd -> index in m_fds
+
+	public:
+		int Add(sock_t fd, short events, bool edgeTriggered, void* userData) override;
+		int Modify(sock_t fd, short events, bool edgeTriggered, void* userData) override;
+		int Remove(sock_t fd) override;
+		int Wait(std::vector<Event>& out, int timeoutMs) override;
+
+		Backend GetBackend() const override { return Backend::POLL; }
+	};
+
+#ifdef NECRO_HAS_EPOLL
+	//-----------------------------------------------------------------------------------------------------
+	// epoll backend, only the ready fds are returned by Wait()
+	//-----------------------------------------------------------------------------------------------------
+	class EpollSocketPoller : public SocketPoller
+	{
+	private:
+		static constexpr int MAX_EVENTS_PER_WAIT = 256;
+
+		int m_epfd;
+		std::vector<struct epoll_event> m_readyEvents;
+
+	public:
+		EpollSocketPoller();
+		~EpollSocketPoller();
+
+		int Add(sock_t fd, short events, bool edgeTriggered, void* userData) override;
+		int Modify(sock_t fd, short events, bool edgeTriggered, void* userData) override;
+		int Remove(sock_t fd) override;
+		int Wait(std::vector<Event>& out, int timeoutMs) override;
+
+		Backend GetBackend() const override { return Backend::EPOLL; }
+	};
+#endif
+
+}
+
+#endif
@@ -5,6 +5,23 @@
 #include "WinSock2.h"
 #else
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <csignal>
+
+// Winsock names used across the codebase, mapped to their POSIX equivalents
+#ifndef INVALID_SOCKET
+#define INVALID_SOCKET (-1)
+#endif
+
+#ifndef SOCKET_ERROR
+#define SOCKET_ERROR (-1)
+#endif
 #endif
 
 #include "ConsoleLogger.h"
@@ -68,7 +85,7 @@ namespace NECRO
 		}
 
 		//---------------------------------------------------------
-		// Initializes Winsock if on windows, otherwise do nothing.
+		// Initializes Winsock if on windows, otherwise ignores SIGPIPE.
 		//---------------------------------------------------------
 		inline void Initialize()
 		{
@@ -85,6 +102,9 @@ namespace NECRO
 			}
 
 			LOG_OK("SocketUtility::Initialize() successful!");
+#else
+			// OpenSSL writes through plain write(), a close_notify sent to a peer that's already gone must not kill the process
+			signal(SIGPIPE, SIG_IGN);
 #endif
 		}
 	};
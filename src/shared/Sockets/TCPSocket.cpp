@@ -1,12 +1,16 @@
 #include "TCPSocket.h"
 #include "SocketUtility.h"
+#include "SocketPoller.h"
 
 #ifndef _WIN32
 #include <sys/socket.h>
+#include <sys/uio.h>
 #endif
 
 #include <iostream>
 #include <string>
+#include <vector>
+#include <algorithm>
 
 #include "ConsoleLogger.h"
 #include "FileLogger.h"
@@ -102,73 +106,235 @@ namespace NECRO
 
 	void TCPSocket::QueuePacket(NetworkMessage&& pckt)
 	{
-		m_outQueue.push(std::move(pckt));
+		if (m_batchCipher)
+		{
+			m_batchPendingBytes += pckt.GetActiveSize();
+			m_batchPending.push_back(std::move(pckt));
+
+			// Don't let a single frame grow without bound, seal what we have and start a new batch
+			if (m_batchPending.size() >= BATCH_SEAL_MAX_MESSAGES || m_batchPendingBytes >= BATCH_SEAL_MAX_BYTES)
+				SealPendingBatch();
+		}
+		else
+			m_outQueue.push_back(std::move(pckt));
+
+		UpdatePollEvents();
+	}
+
+	//-----------------------------------------------------------------------------------------------------
+	// Seals the messages waiting in m_batchPending and moves the result to the outQueue.
+	// A lone message is sealed as a regular frame, since the batch index would only add overhead.
+	// Returns 0 on success, -1 if encryption failed (the pending messages are dropped)
+	//-----------------------------------------------------------------------------------------------------
+	int TCPSocket::SealPendingBatch()
+	{
+		if (m_batchPending.empty())
+			return 0;
+
+		int ret;
+		if (m_batchPending.size() == 1)
+		{
+			ret = m_batchPending.front().AESEncrypt(*m_batchCipher, *m_batchIV, nullptr, 0);
+
+			if (ret >= 0)
+				m_outQueue.push_back(std::move(m_batchPending.front()));
+		}
+		else
+		{
+			NetworkMessage frame(NetworkMessage::AES_HEADER_SIZE + sizeof(uint16_t) + m_batchPending.size() * sizeof(uint32_t) + m_batchPendingBytes);
+			ret = frame.AESSealBatch(*m_batchCipher, *m_batchIV, m_batchPending.begin(), m_batchPending.end());
+
+			if (ret >= 0)
+				m_outQueue.push_back(std::move(frame));
+		}
+
+		m_batchPending.clear();
+		m_batchPendingBytes = 0;
+
+		if (ret < 0)
+		{
+			LOG_ERROR("TCPSocket::SealPendingBatch() failed to encrypt the outgoing messages.");
+			return -1;
+		}
+
+		return 0;
+	}
+
+	//-----------------------------------------------------------------------------------------------------
+	// Polls for POLLOUT only while there's something in the outQueue
+	//-----------------------------------------------------------------------------------------------------
+	void TCPSocket::UpdatePollEvents()
+	{
+		bool wantsOut = WantsWrite();
 
 		// Update pfd events
 		if (m_pfd)
-			m_pfd->events = POLLIN | (HasPendingData() ? POLLOUT : 0);
+			m_pfd->events = POLLIN | (wantsOut ? POLLOUT : 0);
+
+		if (m_poller && wantsOut != m_pollOutArmed && IsOpen())
+		{
+			if (m_poller->Modify(m_socket, POLLIN | (wantsOut ? POLLOUT : 0), true, this) == 0)
+				m_pollOutArmed = wantsOut;
+		}
 	}
 
+	//-----------------------------------------------------------------------------------------------------
+	// Sends as much of the outQueue as possible with a single syscall (writev) or a single TLS record.
+	// Returns the bytes sent, 0 if the socket would block, -1 on error (the socket is closed)
+	//-----------------------------------------------------------------------------------------------------
 	int TCPSocket::Send()
 	{
+		// Seal what was queued during this tick
+		if (!m_batchPending.empty() && SealPendingBatch() != 0)
+		{
+			Close();
+			return -1;
+		}
+
 		if (m_outQueue.empty())
 			return 0;
 
-		NetworkMessage& out = m_outQueue.front();
+		int bytesSent = m_usesTLS ? SendTLS() : SendPlain();
 
-		int bytesSent = 0;
-		size_t sslBytesSent;
-		if (!m_usesTLS)
+		if (bytesSent >= 0)
 		{
-			bytesSent = send(m_socket, reinterpret_cast<const char*>(out.GetReadPointer()), out.GetActiveSize(), 0);
+			ConsumeSent(static_cast<size_t>(bytesSent));
+			UpdatePollEvents();
+		}
 
-			if (bytesSent < 0)
-			{
-				if (SocketUtility::ErrorIsWouldBlock())
-					return 0;
+		// SendCallback(); needed?
 
-				//Shutdown();
-				Close();
+		return bytesSent;
+	}
 
-				LOG_ERROR(std::string("Error during TCPSocket::Send() [") + std::to_string(SocketUtility::GetLastError()) + "]");
-				return SocketUtility::GetLastError();
-			}
+	int TCPSocket::SendPlain()
+	{
+		// Gather the active part of the queued messages
+		int count = 0;
+
+#ifdef _WIN32
+		WSABUF bufs[SEND_MAX_IOV];
+		for (auto it = m_outQueue.begin(); it != m_outQueue.end() && count < SEND_MAX_IOV; ++it, ++count)
+		{
+			bufs[count].buf = reinterpret_cast<CHAR*>(it->GetReadPointer());
+			bufs[count].len = static_cast<ULONG>(it->GetActiveSize());
+		}
+
+		DWORD sent = 0;
+		int res = WSASend(m_socket, bufs, static_cast<DWORD>(count), &sent, 0, nullptr, nullptr);
+		int bytesSent = (res == 0) ? static_cast<int>(sent) : -1;
+#else
+		iovec iov[SEND_MAX_IOV];
+		for (auto it = m_outQueue.begin(); it != m_outQueue.end() && count < SEND_MAX_IOV; ++it, ++count)
+		{
+			iov[count].iov_base = it->GetReadPointer();
+			iov[count].iov_len = it->GetActiveSize();
+		}
+
+		// sendmsg instead of writev so we can ask for no SIGPIPE
+		msghdr msg{};
+		msg.msg_iov = iov;
+		msg.msg_iovlen = count;
+
+		int bytesSent = static_cast<int>(sendmsg(m_socket, &msg, MSG_NOSIGNAL));
+#endif
+
+		if (bytesSent < 0)
+		{
+			if (SocketUtility::ErrorIsWouldBlock())
+				return 0;
+
+			//Shutdown();
+			Close();
+
+			LOG_ERROR(std::string("Error during TCPSocket::Send() [") + std::to_string(SocketUtility::GetLastError()) + "]");
+			return -1;
+		}
+
+		return bytesSent;
+	}
+
+	int TCPSocket::SendTLS()
+	{
+		// Offloaded to the kernel: no need to coalesce for SSL_write_ex, the messages are gathered as they are
+		if (m_ktlsSend)
+			return SendPlain();
+
+		// Scratch buffer for coalescing, shared by all the sockets of this thread
+		thread_local std::vector<uint8_t> coalesceBuf;
+
+		const uint8_t* data;
+		size_t len;
+
+		// A retry must pass the same bytes as the failed write, the queue only grows at the back so its first m_tlsRetryLen bytes didn't change
+		size_t maxLen = m_tlsRetryLen > 0 ? m_tlsRetryLen : TLS_MAX_RECORD_PAYLOAD;
+
+		NetworkMessage& front = m_outQueue.front();
+		if (front.GetActiveSize() >= maxLen || m_outQueue.size() == 1)
+		{
+			// Nothing to coalesce, write straight from the message
+			data = front.GetReadPointer();
+			len = std::min(front.GetActiveSize(), maxLen);
 		}
 		else
 		{
-			int ret = SSL_write_ex(m_ssl, reinterpret_cast<const char*>(out.GetReadPointer()), out.GetActiveSize(), &sslBytesSent);
+			coalesceBuf.clear();
 
-			if (ret <= 0)
+			for (auto it = m_outQueue.begin(); it != m_outQueue.end() && coalesceBuf.size() < maxLen; ++it)
 			{
-				int sslError = SSL_get_error(m_ssl, ret);
-				if (sslError == SSL_ERROR_WANT_READ || sslError == SSL_ERROR_WANT_WRITE)
-					return 0;
+				size_t toCopy = std::min(it->GetActiveSize(), maxLen - coalesceBuf.size());
+				coalesceBuf.insert(coalesceBuf.end(), it->GetReadPointer(), it->GetReadPointer() + toCopy);
+			}
 
-				//Shutdown();
-				Close();
+			data = coalesceBuf.data();
+			len = coalesceBuf.size();
+		}
 
-				LOG_ERROR(std::string("Error during TCPSocket::Send() [") +
-					std::to_string(sslError) + "]");
-				return sslError;
+		size_t sslBytesSent = 0;
+		int ret = SSL_write_ex(m_ssl, data, len, &sslBytesSent);
+
+		if (ret <= 0)
+		{
+			int sslError = SSL_get_error(m_ssl, ret);
+			if (sslError == SSL_ERROR_WANT_READ || sslError == SSL_ERROR_WANT_WRITE)
+			{
+				m_tlsRetryLen = len;
+				return 0;
 			}
-		}
 
-		if (m_usesTLS)
-			bytesSent = sslBytesSent;
+			//Shutdown();
+			Close();
 
-		// Mark that 'bytesSent' were sent
-		out.ReadCompleted(bytesSent);
+			LOG_ERROR(std::string("Error during TCPSocket::Send() [") +
+				std::to_string(sslError) + "]");
+			return -1;
+		}
 
-		if (out.GetActiveSize() == 0)
-			m_outQueue.pop(); // if whole packet was sent, pop it from the queue, otherwise we had a short send and will come back later
+		m_tlsRetryLen = 0;
+		return static_cast<int>(sslBytesSent);
+	}
 
-		// SendCallback(); needed?
+	//-----------------------------------------------------------------------------------------------------
+	// Marks 'bytes' of the outQueue as sent: fully sent messages are popped, a partially sent one keeps
+	// its read position so the next Send() resumes from there
+	//-----------------------------------------------------------------------------------------------------
+	void TCPSocket::ConsumeSent(size_t bytes)
+	{
+		while (!m_outQueue.empty())
+		{
+			NetworkMessage& out = m_outQueue.front();
+			size_t active = out.GetActiveSize();
 
-		// Update pfd events
-		if (m_pfd)
-			m_pfd->events = POLLIN | (HasPendingData() ? POLLOUT : 0);
+			// Empty messages are popped as well, they would never be "sent" otherwise
+			if (bytes < active)
+			{
+				out.ReadCompleted(bytes);
+				return;
+			}
 
-		return bytesSent;
+			bytes -= active;
+			m_outQueue.pop_front();
+		}
 	}
 
 	int TCPSocket::SysSend(const char* buf, int len)
@@ -199,20 +365,31 @@ namespace NECRO
 		if (!IsOpen())
 			return 0;
 
-		m_inBuffer.CompactData();
-		m_inBuffer.EnlargeBufferIfNeeded();
+		// Receive straight into the ring
+		size_t space = 0;
+		uint8_t* writePtr = m_inBuffer.GetWriteSpan(space);
+
+		if (space == 0)
+		{
+			LOG_WARNING("TCPSocket::Receive() the peer sent more than {} bytes that can't be parsed, closing the connection.", m_inBuffer.GetMaxCapacity());
+			Close();
+			return -1;
+		}
 
-		// Manually write on the inBuffer
 		int bytesReceived = 0;
 		size_t sslBytesReceived = 0;
 		if (!m_usesTLS)
 		{
-			bytesReceived = recv(m_socket, reinterpret_cast<char*>(m_inBuffer.GetWritePointer()), m_inBuffer.GetRemainingSpace(), 0);
+			bytesReceived = recv(m_socket, reinterpret_cast<char*>(writePtr), static_cast<int>(space), 0);
 
 			if (bytesReceived < 0)
 			{
 				if (SocketUtility::ErrorIsWouldBlock())
+				{
+					// Nothing more to read for now, don't keep memory we don't need
+					m_inBuffer.ShrinkIfIdle();
 					return 0;
+				}
 
 				//Shutdown();
 				Close();
@@ -220,16 +397,27 @@ namespace NECRO
 				LOG_ERROR(std::string("Error during TCPSocket::Receive() [") + std::to_string(SocketUtility::GetLastError()) + "]");
 				return -1;
 			}
+			else if (bytesReceived == 0)
+			{
+				// Peer closed the connection
+				LOG_DEBUG("Received EOF. Closing socket.");
+				Close();
+				return 0;
+			}
 		}
 		else
 		{
-			int ret = SSL_read_ex(m_ssl, reinterpret_cast<char*>(m_inBuffer.GetWritePointer()), m_inBuffer.GetRemainingSpace(), &sslBytesReceived);
+			int ret = SSL_read_ex(m_ssl, reinterpret_cast<char*>(writePtr), space, &sslBytesReceived);
 
 			if (ret <= 0)
 			{
 				int sslError = SSL_get_error(m_ssl, ret);
 				if (sslError == SSL_ERROR_WANT_READ || sslError == SSL_ERROR_WANT_WRITE)
+				{
+					// Nothing more to read for now, don't keep memory we don't need
+					m_inBuffer.ShrinkIfIdle();
 					return 0;
+				}
 				else if (sslError == SSL_ERROR_ZERO_RETURN)
 				{
 					// Shutdown gracefully
@@ -243,8 +431,8 @@ namespace NECRO
 					//Shutdown();
 					Close();
 
-					LOG_ERROR(std::string("Error during TCPSocket::Receive() [") + std::to_string(SocketUtility::GetLastError()) + "]");
-					return sslError;
+					LOG_ERROR(std::string("Error during TCPSocket::Receive() [") + std::to_string(sslError) + "]");
+					return -1;
 				}
 			}
 		}
@@ -297,7 +485,7 @@ namespace NECRO
 
 		return SocketUtility::SU_NO_ERROR_VAL;
 #else
-		int flags = fcntl(fd, F_GETFL, 0);
+		int flags = fcntl(m_socket, F_GETFL, 0);
 
 		if (flags == -1)
 		{
@@ -307,7 +495,7 @@ namespace NECRO
 
 		flags = blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK);
 
-		result = fcntl(fd, F_SETFL, flags);
+		int result = fcntl(m_socket, F_SETFL, flags);
 
 		if (result != 0)
 		{
@@ -364,6 +552,19 @@ namespace NECRO
 
 	int TCPSocket::Close()
 	{
+		if (m_socket == INVALID_SOCKET)
+			return 0;
+
+		// The poller must forget about this fd before it gets closed (and possibly reused by the next accept)
+		if (m_poller)
+		{
+			m_poller->Remove(m_socket);
+			m_poller = nullptr;
+		}
+
+		// When TLS is used the socket is owned by the BIO (BIO_CLOSE), so SSL_free already closes it
+		bool socketOwnedByBio = false;
+
 		// Free OpenSSL data
 		if (m_usesTLS && m_ssl != nullptr)
 		{
@@ -374,15 +575,31 @@ namespace NECRO
 			}
 			SSL_free(m_ssl);
 			m_ssl = nullptr;
+
+			socketOwnedByBio = (m_bio != nullptr);
+			m_bio = nullptr;
 		}
-#ifdef _WIN32
 
-		int result = closesocket(m_socket);
-		return result;
+		int result = 0;
+		if (!socketOwnedByBio)
+		{
+#ifdef _WIN32
+			result = closesocket(m_socket);
 #else
-		int result = close(m_socket);
-		return result;
+			result = close(m_socket);
 #endif
+		}
+
+		m_socket = INVALID_SOCKET;
+		m_closed = true;
+
+		// Nothing queued can be sent anymore, give the buffers back to the pool now
+		std::deque<NetworkMessage>().swap(m_outQueue);
+		std::vector<NetworkMessage>().swap(m_batchPending);
+		m_batchPendingBytes = 0;
+		m_tlsRetryLen = 0;
+
+		return result;
 	}
 
 	// OpenSSL
@@ -406,6 +623,9 @@ namespace NECRO
 
 		OpenSSLManager::SetSNIHostname(m_ssl, hostname);
 		OpenSSLManager::SetCertVerificationHostname(m_ssl, hostname);
+
+		// Try to resume the last session we had with this server
+		OpenSSLManager::ClientOfferSession(m_ssl, hostname);
 	}
 
 	int TCPSocket::TLSPerformHandshake()
@@ -443,15 +663,86 @@ namespace NECRO
 			if (err == SSL_ERROR_SSL)
 			{
 				if (SSL_get_verify_result(m_ssl) != X509_V_OK)
+				{
 					LOG_ERROR("Verify error: {}\n", X509_verify_cert_error_string(SSL_get_verify_result(m_ssl)));
+				}
 
 				success = false;
 			}
 			break;
 		}
 
+		if (success)
+			OpenSSLManager::RecordHandshake(m_ssl);
+
 		// Handshake performed!
 		return (success) ? 1 : 0;
 	}
 
+	//-----------------------------------------------------------------------------------------------------
+	// Advances a server-side handshake on a non-blocking socket, to be called every time the socket is ready.
+	// Returns 1 when the handshake is completed, 0 if it needs more I/O, -1 on failure
+	//-----------------------------------------------------------------------------------------------------
+	int TCPSocket::TLSAccept()
+	{
+		int ret = TLSAcceptStep();
+
+		if (ret >= 0)
+			UpdatePollEvents();
+
+		return ret;
+	}
+
+	//-----------------------------------------------------------------------------------------------------
+	// Same as TLSAccept() but leaves the poll interest alone, so it can run on a thread other than the reactor's.
+	// The caller updates the poll events once the step is back on the reactor
+	//-----------------------------------------------------------------------------------------------------
+	int TCPSocket::TLSAcceptStep()
+	{
+		m_tlsWantsWrite = false;
+
+		int ret = SSL_accept(m_ssl);
+
+		if (ret == 1)
+		{
+			OpenSSLManager::RecordHandshake(m_ssl);
+			m_ktlsSend = OpenSSLManager::RecordKTLS(m_ssl);
+			return 1;
+		}
+
+		int err = SSL_get_error(m_ssl, ret);
+
+		if (err == SSL_ERROR_WANT_READ)
+			return 0;
+
+		if (err == SSL_ERROR_WANT_WRITE)
+		{
+			m_tlsWantsWrite = true;
+			return 0;
+		}
+
+		if (err == SSL_ERROR_ZERO_RETURN)
+		{
+			LOG_INFO("TLS connection closed by peer during handshake.");
+			return -1;
+		}
+
+		if (err == SSL_ERROR_SYSCALL)
+		{
+			LOG_ERROR("System call error during TLS handshake. Ret: {}.", ret);
+			return -1;
+		}
+
+		if (err == SSL_ERROR_SSL)
+		{
+			if (SSL_get_verify_result(m_ssl) != X509_V_OK)
+			{
+				LOG_ERROR("Verify error: {}\n", X509_verify_cert_error_string(SSL_get_verify_result(m_ssl)));
+			}
+		}
+
+		LOG_ERROR("TLSAccept failed!");
+		return -1;
+	}
+
 }
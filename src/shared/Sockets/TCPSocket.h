@@ -8,12 +8,14 @@
 
 #include <memory>
 #include <cstdint>
-#include <queue>
+#include <deque>
+#include <vector>
 
 #include <openssl/ssl.h>
 
 #include "SocketAddress.h"
 #include "NetworkMessage.h"
+#include "RecvBuffer.h"
 
 #include "SocketUtility.h"
 #include "ConsoleLogger.h"
@@ -21,6 +23,8 @@
 
 namespace NECRO
 {
+	class SocketPoller;
+
 #ifdef _WIN32
 	typedef SOCKET sock_t;
 #else
@@ -29,6 +33,16 @@ namespace NECRO
 
 	inline constexpr int READ_BLOCK_SIZE = 4096;
 
+	// Max number of queued messages gathered by a single Send()
+	inline constexpr int SEND_MAX_IOV = 64;
+
+	// Max plaintext coalesced in a single SSL_write_ex, the payload of a full TLS record
+	inline constexpr size_t TLS_MAX_RECORD_PAYLOAD = 16384;
+
+	// Limits of a batch sealed as one AES-GCM frame, reaching one of them seals the batch right away
+	inline constexpr size_t BATCH_SEAL_MAX_MESSAGES = 256;
+	inline constexpr size_t BATCH_SEAL_MAX_BYTES = 64 * 1024;
+
 	inline constexpr int TCP_LISTEN_DEFUALT_BACKLOG = SOMAXCONN;
 
 	enum class SocketAddressesFamily
@@ -50,20 +64,40 @@ namespace NECRO
 		uint16_t		m_remotePort;
 
 		// Read/Write buffers
-		NetworkMessage				m_inBuffer;
-		std::queue<NetworkMessage>	m_outQueue;
+		RecvBuffer					m_inBuffer;
+		std::deque<NetworkMessage>	m_outQueue;
+
+		// Length of the last SSL_write_ex that returned WANT_READ/WANT_WRITE: the retry must pass (at least) the same bytes
+		size_t						m_tlsRetryLen = 0;
+
+		// Batched sealing (optional, see EnableBatchSealing): messages queued between two Send() wait here in plaintext
+		AES::SessionCipher*			m_batchCipher = nullptr;
+		AES::IV*					m_batchIV = nullptr;
+		std::vector<NetworkMessage>	m_batchPending;
+		size_t						m_batchPendingBytes = 0;
 
 		bool m_closed = false;
 
 		// OpenSSL support
 		bool m_usesTLS = false;
+		bool m_ktlsSend = false;	// the kernel encrypts the records (kTLS), the queue is sent with plain sendmsg
 		SSL* m_ssl;
 		BIO* m_bio;
 
 		// Used for dynamic POLLIN | POLLOUT behavior, save the pfd and we'll update the events to look for in base of the content of the outQueue
 		// If the outqueue is empty, only poll for POLLIN events, otherwise, also POLLOUT events
 		// This is better than the callback Send() approach because even if a Send fails because the socket was not writable at the time of the callback, we'll still try to send the packets later
-		pollfd* m_pfd;
+		pollfd* m_pfd = nullptr;
+
+		// Same as above, but for sockets registered in a SocketPoller (epoll or the pollfd array it owns): interest is changed through the poller
+		// and only when it actually changes, so we don't pay an epoll_ctl for every queued packet
+		SocketPoller*	m_poller = nullptr;
+		bool			m_pollOutArmed = false;
+
+		// Set while a non-blocking TLS handshake needs the socket to become writable before it can go on
+		bool			m_tlsWantsWrite = false;
+
+		void UpdatePollEvents();
 
 
 	public:
@@ -82,17 +116,26 @@ namespace NECRO
 		int							Listen(int backlog = TCP_LISTEN_DEFUALT_BACKLOG);
 
 		// Templated Accept
+		// With nonBlocking the accepted socket comes out already non-blocking (and close-on-exec), on Linux accept4 does it in the same syscall
 		template<typename T = TCPSocket>
-		std::shared_ptr<T> Accept(SocketAddress& addr)
+		std::shared_ptr<T> Accept(SocketAddress& addr, bool nonBlocking = false)
 		{
 			static_assert(std::is_base_of<TCPSocket, T>::value || std::is_same<TCPSocket, T>::value, "T must be TCPSocket or derived from it");
 
-			int addrLen = addr.GetSize();
+			socklen_t addrLen = static_cast<socklen_t>(addr.GetSize());
+#ifdef __linux__
+			sock_t inSocket = accept4(m_socket, &addr.m_addr, &addrLen, SOCK_CLOEXEC | (nonBlocking ? SOCK_NONBLOCK : 0));
+#else
 			sock_t inSocket = accept(m_socket, &addr.m_addr, &addrLen);
+#endif
 
 			if (inSocket != INVALID_SOCKET)
 			{
 				std::shared_ptr<T> newSocket = std::make_shared<T>(inSocket);
+#ifndef __linux__
+				if (nonBlocking)
+					newSocket->SetBlockingEnabled(false);
+#endif
 				newSocket->m_remoteAddress = addr;
 				newSocket->m_remotePort = ntohs(reinterpret_cast<sockaddr_in*>(&addr.m_addr)->sin_port);
 				return newSocket;
@@ -110,7 +153,7 @@ namespace NECRO
 		sock_t AcceptSys()
 		{
 			sockaddr_in otherAddress;
-			int otherAddressLength = sizeof(otherAddress);
+			socklen_t otherAddressLength = sizeof(otherAddress);
 			sock_t acceptedSocket = accept(m_socket, (struct sockaddr*)&otherAddress, &otherAddressLength);
 			return acceptedSocket;
 		}
@@ -119,7 +162,11 @@ namespace NECRO
 		int							Connect(const SocketAddress& addr);
 
 		void						QueuePacket(NetworkMessage&& pckt);
+		int							SealPendingBatch();
 		int							Send();
+		int							SendPlain();
+		int							SendTLS();
+		void						ConsumeSent(size_t bytes);
 		int							SysSend(const char* buf, int len);
 		int							Receive();
 		int							SysReceive(char* buf, int len);
@@ -145,14 +192,54 @@ namespace NECRO
 			m_pfd = fd;
 		}
 
+		//-----------------------------------------------------------------------------------------------------
+		// Sets the poller this socket has been registered in, POLLOUT interest will be toggled through it
+		//-----------------------------------------------------------------------------------------------------
+		void SetPoller(SocketPoller* poller)
+		{
+			m_poller = poller;
+			m_pollOutArmed = false;
+		}
+
+		SocketPoller* GetPoller()
+		{
+			return m_poller;
+		}
+
 		uint16_t GetPort()
 		{
 			return m_remotePort;
 		}
 
+		//-----------------------------------------------------------------------------------------------------
+		// Max bytes of received but not yet parsed data, a peer that goes over it is disconnected
+		//-----------------------------------------------------------------------------------------------------
+		void SetReceiveBufferLimit(size_t maxBytes)
+		{
+			m_inBuffer.SetMaxCapacity(maxBytes);
+		}
+
+		//-----------------------------------------------------------------------------------------------------
+		// Everything queued during a tick is sealed as one AES-GCM frame (NetworkMessage::AESSealBatch) instead of one frame per message.
+		// cipher and iv are owned by the caller and must outlive the socket (or until this is called again with nullptr to disable it)
+		//-----------------------------------------------------------------------------------------------------
+		void EnableBatchSealing(AES::SessionCipher* cipher, AES::IV* iv)
+		{
+			if (m_batchCipher && !m_batchPending.empty())
+				SealPendingBatch();
+
+			m_batchCipher = cipher;
+			m_batchIV = cipher ? iv : nullptr;
+		}
+
 		bool HasPendingData() const
 		{
-			return !m_outQueue.empty();
+			return !m_outQueue.empty() || !m_batchPending.empty();
+		}
+
+		bool WantsWrite() const
+		{
+			return HasPendingData() || m_tlsWantsWrite;
 		}
 
 		int							Shutdown();
@@ -169,6 +256,8 @@ namespace NECRO
 		void ServerTLSSetup(const char* hostname);
 		void ClientTLSSetup(const char* hostname);
 		int TLSPerformHandshake();
+		int TLSAccept();
+		int TLSAcceptStep();
 	};
 
 }
@@ -0,0 +1,163 @@
+#ifndef NECRO_MPSC_QUEUE_H
+#define NECRO_MPSC_QUEUE_H
+
+#include <atomic>
+#include <memory>
+#include <new>
+#include <cstddef>
+#include <utility>
+#include <algorithm>
+
+namespace NECRO
+{
+	//-----------------------------------------------------------------------------------------------------
+	// Bounded lock-free multi-producer single-consumer queue (D. Vyukov's bounded queue, with a plain
+	// consumer side since there's only one). Capacity is rounded up to a power of two.
+	// TryPush() fails when the queue is full instead of blocking, so the caller can apply back-pressure
+	//-----------------------------------------------------------------------------------------------------
+	template<typename T>
+	class MPSCQueue
+	{
+	private:
+		static constexpr size_t CACHE_LINE = 64;
+
+		struct Cell
+		{
+			std::atomic<size_t>							seq;
+			typename std::aligned_storage<sizeof(T), alignof(T)>::type	storage;
+
+			T* Get() { return std::launder(reinterpret_cast<T*>(&storage)); }
+		};
+
+		std::unique_ptr<Cell[]>				m_cells;
+		size_t								m_mask;
+
+		alignas(CACHE_LINE) std::atomic<size_t>	m_enqueuePos{ 0 };	// producers
+		alignas(CACHE_LINE) std::atomic<size_t>	m_dequeuePos{ 0 };	// consumer (atomic only so Size() can be read from other threads)
+		alignas(CACHE_LINE) std::atomic<size_t>	m_highWaterMark{ 0 };
+
+		static size_t RoundUpPow2(size_t v)
+		{
+			size_t p = 2;
+			while (p < v)
+				p <<= 1;
+			return p;
+		}
+
+	public:
+		explicit MPSCQueue(size_t capacity)
+		{
+			size_t size = RoundUpPow2(capacity);
+
+			m_cells = std::make_unique<Cell[]>(size);
+			m_mask = size - 1;
+
+			for (size_t i = 0; i < size; i++)
+				m_cells[i].seq.store(i, std::memory_order_relaxed);
+		}
+
+		~MPSCQueue()
+		{
+			while (Front())
+				PopFront();
+		}
+
+		MPSCQueue(const MPSCQueue&) = delete;
+		MPSCQueue& operator=(const MPSCQueue&) = delete;
+
+		//-----------------------------------------------------------------------------------------------------
+		// Any thread. Returns false if the queue is full, 'value' is left untouched in that case
+		//-----------------------------------------------------------------------------------------------------
+		bool TryPush(T&& value)
+		{
+			size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+			Cell* cell;
+
+			while (true)
+			{
+				cell = &m_cells[pos & m_mask];
+				size_t seq = cell->seq.load(std::memory_order_acquire);
+				intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+
+				if (diff == 0)
+				{
+					if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+						break;
+				}
+				else if (diff < 0)
+					return false;	// full
+				else
+					pos = m_enqueuePos.load(std::memory_order_relaxed);
+			}
+
+			new (&cell->storage) T(std::move(value));
+			cell->seq.store(pos + 1, std::memory_order_release);
+
+			// Track the deepest the queue has been (the consumer may have popped this cell already)
+			size_t deq = m_dequeuePos.load(std::memory_order_relaxed);
+			size_t depth = pos + 1 > deq ? std::min(pos + 1 - deq, m_mask + 1) : 0;
+			size_t hwm = m_highWaterMark.load(std::memory_order_relaxed);
+			while (depth > hwm && !m_highWaterMark.compare_exchange_weak(hwm, depth, std::memory_order_relaxed))
+				;
+
+			return true;
+		}
+
+		//-----------------------------------------------------------------------------------------------------
+		// Consumer only. Returns the element at the front, or nullptr if there's none ready
+		//-----------------------------------------------------------------------------------------------------
+		T* Front()
+		{
+			size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+			Cell& cell = m_cells[pos & m_mask];
+
+			if (cell.seq.load(std::memory_order_acquire) != pos + 1)
+				return nullptr;
+
+			return cell.Get();
+		}
+
+		//-----------------------------------------------------------------------------------------------------
+		// Consumer only, must follow a successful Front(). Moves the front element out and frees its cell
+		//-----------------------------------------------------------------------------------------------------
+		T PopFront()
+		{
+			size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+			Cell& cell = m_cells[pos & m_mask];
+
+			T value(std::move(*cell.Get()));
+			cell.Get()->~T();
+
+			cell.seq.store(pos + m_mask + 1, std::memory_order_release);
+			m_dequeuePos.store(pos + 1, std::memory_order_relaxed);
+
+			return value;
+		}
+
+		bool Empty()
+		{
+			return Front() == nullptr;
+		}
+
+		// Approximate when read from other threads
+		size_t Size() const
+		{
+			size_t enq = m_enqueuePos.load(std::memory_order_relaxed);
+			size_t deq = m_dequeuePos.load(std::memory_order_relaxed);
+			return enq > deq ? enq - deq : 0;
+		}
+
+		size_t Capacity() const
+		{
+			return m_mask + 1;
+		}
+
+		size_t GetHighWaterMark() const
+		{
+			return m_highWaterMark.load(std::memory_order_relaxed);
+		}
+	};
+
+}
+
+#endif
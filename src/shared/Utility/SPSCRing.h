@@ -0,0 +1,117 @@
+#ifndef NECRO_SPSC_RING_H
+#define NECRO_SPSC_RING_H
+
+#include <atomic>
+#include <memory>
+#include <new>
+#include <cstddef>
+#include <utility>
+
+namespace NECRO
+{
+	//-----------------------------------------------------------------------------------------------------
+	// Bounded lock-free single-producer single-consumer ring. Capacity is rounded up to a power of two.
+	// Each side only writes its own index, so push and pop are a load-acquire and a store-release each
+	//-----------------------------------------------------------------------------------------------------
+	template<typename T>
+	class SPSCRing
+	{
+	private:
+		static constexpr size_t CACHE_LINE = 64;
+
+		typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type Slot;
+
+		std::unique_ptr<Slot[]>	m_slots;
+		size_t					m_mask;
+
+		alignas(CACHE_LINE) std::atomic<size_t>	m_head{ 0 };	// next to pop, written by the consumer
+		alignas(CACHE_LINE) std::atomic<size_t>	m_tail{ 0 };	// next to push, written by the producer
+		std::atomic<size_t>						m_highWaterMark{ 0 };	// written by the producer only
+
+		T* At(size_t pos) { return std::launder(reinterpret_cast<T*>(&m_slots[pos & m_mask])); }
+
+	public:
+		explicit SPSCRing(size_t capacity)
+		{
+			size_t size = 2;
+			while (size < capacity)
+				size <<= 1;
+
+			m_slots = std::make_unique<Slot[]>(size);
+			m_mask = size - 1;
+		}
+
+		~SPSCRing()
+		{
+			size_t head = m_head.load(std::memory_order_relaxed);
+			size_t tail = m_tail.load(std::memory_order_relaxed);
+
+			for (; head != tail; head++)
+				At(head)->~T();
+		}
+
+		SPSCRing(const SPSCRing&) = delete;
+		SPSCRing& operator=(const SPSCRing&) = delete;
+
+		//-----------------------------------------------------------------------------------------------------
+		// Producer only. Returns false if the ring is full, 'value' is left untouched in that case
+		//-----------------------------------------------------------------------------------------------------
+		bool TryPush(T&& value)
+		{
+			size_t tail = m_tail.load(std::memory_order_relaxed);
+			size_t head = m_head.load(std::memory_order_acquire);
+
+			if (tail - head > m_mask)
+				return false;
+
+			new (&m_slots[tail & m_mask]) T(std::move(value));
+			m_tail.store(tail + 1, std::memory_order_release);
+
+			if (tail + 1 - head > m_highWaterMark.load(std::memory_order_relaxed))
+				m_highWaterMark.store(tail + 1 - head, std::memory_order_relaxed);
+
+			return true;
+		}
+
+		//-----------------------------------------------------------------------------------------------------
+		// Consumer only. Calls f(T&) on every element available right now and pops them, returns how many
+		//-----------------------------------------------------------------------------------------------------
+		template<typename F>
+		size_t Drain(F&& f)
+		{
+			size_t head = m_head.load(std::memory_order_relaxed);
+			size_t tail = m_tail.load(std::memory_order_acquire);
+			size_t count = tail - head;
+
+			for (; head != tail; head++)
+			{
+				T* elem = At(head);
+				f(*elem);
+				elem->~T();
+
+				// Free the slot right away, so the producer can reuse it while we're running the rest
+				m_head.store(head + 1, std::memory_order_release);
+			}
+
+			return count;
+		}
+
+		size_t Size() const
+		{
+			return m_tail.load(std::memory_order_relaxed) - m_head.load(std::memory_order_relaxed);
+		}
+
+		size_t Capacity() const
+		{
+			return m_mask + 1;
+		}
+
+		size_t GetHighWaterMark() const
+		{
+			return m_highWaterMark.load(std::memory_order_relaxed);
+		}
+	};
+
+}
+
+#endif
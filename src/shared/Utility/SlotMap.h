@@ -0,0 +1,151 @@
+#ifndef NECRO_SLOT_MAP_H
+#define NECRO_SLOT_MAP_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <utility>
+
+namespace NECRO
+{
+	//-----------------------------------------------------------------------------------------------------
+	// Refers to an element of a SlotMap. It stays valid until the element is removed, after that it
+	// resolves to nothing, even if the slot has been reused by another element
+	//-----------------------------------------------------------------------------------------------------
+	struct SlotHandle
+	{
+		static constexpr uint32_t INVALID_INDEX = UINT32_MAX;
+
+		uint32_t index = INVALID_INDEX;
+		uint32_t generation = 0;
+
+		bool IsValid() const
+		{
+			return index != INVALID_INDEX;
+		}
+
+		bool operator==(const SlotHandle& other) const
+		{
+			return index == other.index && generation == other.generation;
+		}
+
+		bool operator!=(const SlotHandle& other) const
+		{
+			return !(*this == other);
+		}
+	};
+
+	//-----------------------------------------------------------------------------------------------------
+	// Values are kept dense (swap-and-pop on removal) and reached through a slot table, so insert, lookup
+	// and removal are O(1), iteration only touches live values, and handles don't move when others are removed.
+	// Every slot has a generation that is bumped when its value is removed, handles of an older generation are stale.
+	// Freed slots are reused through a free list
+	//-----------------------------------------------------------------------------------------------------
+	template<typename T>
+	class SlotMap
+	{
+	private:
+		static constexpr uint32_t NO_SLOT = UINT32_MAX;
+
+		struct Slot
+		{
+			uint32_t dense;			// index in m_values while in use, next free slot while in the free list
+			uint32_t generation;
+		};
+
+		std::vector<T>			m_values;
+		std::vector<uint32_t>	m_valueSlot;	// parallel to m_values, the slot that points to each value
+		std::vector<Slot>		m_slots;
+		uint32_t				m_freeHead = NO_SLOT;
+
+	public:
+		SlotHandle Insert(T value)
+		{
+			uint32_t slotIndex;
+
+			if (m_freeHead != NO_SLOT)
+			{
+				slotIndex = m_freeHead;
+				m_freeHead = m_slots[slotIndex].dense;
+			}
+			else
+			{
+				slotIndex = static_cast<uint32_t>(m_slots.size());
+				m_slots.push_back({ NO_SLOT, 0 });
+			}
+
+			Slot& slot = m_slots[slotIndex];
+			slot.dense = static_cast<uint32_t>(m_values.size());
+
+			m_values.push_back(std::move(value));
+			m_valueSlot.push_back(slotIndex);
+
+			return { slotIndex, slot.generation };
+		}
+
+		//-----------------------------------------------------------------------------------------------------
+		// Returns nullptr if the handle is stale
+		//-----------------------------------------------------------------------------------------------------
+		T* Get(SlotHandle h)
+		{
+			if (h.index >= m_slots.size() || m_slots[h.index].generation != h.generation)
+				return nullptr;
+
+			return &m_values[m_slots[h.index].dense];
+		}
+
+		//-----------------------------------------------------------------------------------------------------
+		// Moves the last value in the hole and fixes its slot. Returns false if the handle is stale
+		//-----------------------------------------------------------------------------------------------------
+		bool Remove(SlotHandle h)
+		{
+			if (!Get(h))
+				return false;
+
+			Slot& slot = m_slots[h.index];
+			uint32_t hole = slot.dense;
+			uint32_t last = static_cast<uint32_t>(m_values.size() - 1);
+
+			if (hole != last)
+			{
+				m_values[hole] = std::move(m_values[last]);
+				m_valueSlot[hole] = m_valueSlot[last];
+				m_slots[m_valueSlot[hole]].dense = hole;
+			}
+
+			m_values.pop_back();
+			m_valueSlot.pop_back();
+
+			// Handles to a free slot are all of an older generation, so Get() never resolves them
+			slot.generation++;
+			slot.dense = m_freeHead;
+			m_freeHead = h.index;
+
+			return true;
+		}
+
+		size_t Size() const
+		{
+			return m_values.size();
+		}
+
+		bool Empty() const
+		{
+			return m_values.empty();
+		}
+
+		void Clear()
+		{
+			m_values.clear();
+			m_valueSlot.clear();
+			m_slots.clear();
+			m_freeHead = NO_SLOT;
+		}
+
+		typename std::vector<T>::iterator begin() { return m_values.begin(); }
+		typename std::vector<T>::iterator end() { return m_values.end(); }
+	};
+
+}
+
+#endif
@@ -0,0 +1,346 @@
+#ifndef NECRO_TIMER_WHEEL_H
+#define NECRO_TIMER_WHEEL_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <chrono>
+#include <utility>
+
+#ifdef _MSC_VER
+	#include <intrin.h>
+#endif
+
+#include "SlotMap.h"
+
+namespace NECRO
+{
+	// Refers to a timer armed in a TimerWheel, it resolves to nothing once the timer has expired or has been cancelled
+	typedef SlotHandle TimerHandle;
+
+	//-----------------------------------------------------------------------------------------------------
+	// Hierarchical timing wheel. Time is divided in ticks of a fixed resolution, level 0 has one slot per tick
+	// and every upper level has one slot per revolution of the level below it. A timer is put in the lowest level
+	// that can hold its expiry and moves down (cascades) as the time gets closer, so arm and cancel are O(1)
+	// and advancing only touches the timers that are due.
+	// Timers never expire early: a deadline is rounded up to the next tick.
+	// Timers are nodes of intrusive lists in a pool, reused through a free list, and every slot has an occupancy bit,
+	// so the next tick something has to be done can be found without walking the slots
+	//-----------------------------------------------------------------------------------------------------
+	template<typename T>
+	class TimerWheel
+	{
+	public:
+		typedef std::chrono::steady_clock Clock;
+
+		static constexpr int SLOT_BITS = 6;
+		static constexpr int SLOTS_PER_LEVEL = 1 << SLOT_BITS;
+		static constexpr int LEVELS = 4;
+
+		// Farthest a timer can be armed, in ticks. Later deadlines are clamped to it
+		static constexpr uint64_t MAX_TICKS = (uint64_t(1) << (SLOT_BITS * LEVELS)) - 1;
+
+	private:
+		static constexpr uint32_t NIL = UINT32_MAX;
+		static constexpr uint64_t NO_TICK = UINT64_MAX;
+
+		struct Node
+		{
+			T			value;
+			uint64_t	expiry;			// tick
+			uint32_t	prev;
+			uint32_t	next;			// next node in the slot while armed, next free node while in the free list
+			uint32_t	generation;
+			uint16_t	list;			// level * SLOTS_PER_LEVEL + slot
+		};
+
+		Clock::time_point			m_origin;
+		Clock::duration				m_resolution;
+
+		uint64_t					m_now = 0;	// last tick that has been processed
+
+		std::vector<Node>			m_nodes;
+		uint32_t					m_freeHead = NIL;
+		size_t						m_armed = 0;
+
+		uint32_t					m_heads[LEVELS * SLOTS_PER_LEVEL];
+		uint64_t					m_occupied[LEVELS] = {};
+
+		static int CountTrailingZeros(uint64_t v)
+		{
+#ifdef _MSC_VER
+			unsigned long index;
+			_BitScanForward64(&index, v);
+			return static_cast<int>(index);
+#else
+			return __builtin_ctzll(v);
+#endif
+		}
+
+		//-----------------------------------------------------------------------------------------------------
+		// Distance from start to the first occupied slot of level, going around. -1 if the level is empty
+		//-----------------------------------------------------------------------------------------------------
+		int FirstOccupiedFrom(int level, uint32_t start) const
+		{
+			uint64_t mask = m_occupied[level];
+
+			if (mask == 0)
+				return -1;
+
+			if (start != 0)
+				mask = (mask >> start) | (mask << (SLOTS_PER_LEVEL - start));
+
+			return CountTrailingZeros(mask);
+		}
+
+		void Link(uint32_t index)
+		{
+			Node& node = m_nodes[index];
+
+			// The lowest level that can hold the expiry. The slot is picked by the absolute tick, so the timer is reached (or cascaded) exactly when its tick comes
+			uint64_t delta = node.expiry - m_now;
+			int level = 0;
+			while (level < LEVELS - 1 && delta >= (uint64_t(1) << (SLOT_BITS * (level + 1))))
+				level++;
+
+			uint32_t slot = static_cast<uint32_t>(node.expiry >> (SLOT_BITS * level)) & (SLOTS_PER_LEVEL - 1);
+			uint16_t list = static_cast<uint16_t>(level * SLOTS_PER_LEVEL + slot);
+
+			node.list = list;
+			node.prev = NIL;
+			node.next = m_heads[list];
+
+			if (node.next != NIL)
+				m_nodes[node.next].prev = index;
+
+			m_heads[list] = index;
+			m_occupied[level] |= uint64_t(1) << slot;
+		}
+
+		void Unlink(uint32_t index)
+		{
+			Node& node = m_nodes[index];
+
+			if (node.prev != NIL)
+				m_nodes[node.prev].next = node.next;
+			else
+				m_heads[node.list] = node.next;
+
+			if (node.next != NIL)
+				m_nodes[node.next].prev = node.prev;
+
+			if (m_heads[node.list] == NIL)
+				m_occupied[node.list / SLOTS_PER_LEVEL] &= ~(uint64_t(1) << (node.list % SLOTS_PER_LEVEL));
+		}
+
+		void Free(uint32_t index)
+		{
+			// Handles to a free node are all of an older generation
+			Node& node = m_nodes[index];
+			node.generation++;
+			node.next = m_freeHead;
+			m_freeHead = index;
+			m_armed--;
+		}
+
+		//-----------------------------------------------------------------------------------------------------
+		// The next tick at which a timer expires or an upper slot has to be cascaded, NO_TICK if nothing is armed
+		//-----------------------------------------------------------------------------------------------------
+		uint64_t NextEventTick() const
+		{
+			uint64_t next = NO_TICK;
+
+			// Level 0 holds the next SLOTS_PER_LEVEL ticks
+			int d = FirstOccupiedFrom(0, static_cast<uint32_t>(m_now + 1) & (SLOTS_PER_LEVEL - 1));
+			if (d >= 0)
+				next = m_now + 1 + d;
+
+			// An upper slot is cascaded when the level below it starts a new revolution on it
+			for (int level = 1; level < LEVELS; level++)
+			{
+				uint64_t revolution = m_now >> (SLOT_BITS * level);
+
+				d = FirstOccupiedFrom(level, static_cast<uint32_t>(revolution + 1) & (SLOTS_PER_LEVEL - 1));
+				if (d < 0)
+					continue;
+
+				uint64_t tick = (revolution + 1 + d) << (SLOT_BITS * level);
+				if (tick < next)
+					next = tick;
+			}
+
+			return next;
+		}
+
+		//-----------------------------------------------------------------------------------------------------
+		// Processes m_now: cascades the upper slots that start now, then expires the timers of the level 0 slot
+		//-----------------------------------------------------------------------------------------------------
+		template<typename F>
+		void ProcessTick(F& onExpire)
+		{
+			for (int level = 1; level < LEVELS; level++)
+			{
+				if (m_now & ((uint64_t(1) << (SLOT_BITS * level)) - 1))
+					break;
+
+				uint16_t list = static_cast<uint16_t>(level * SLOTS_PER_LEVEL + ((m_now >> (SLOT_BITS * level)) & (SLOTS_PER_LEVEL - 1)));
+
+				// They all land in lower levels, never back in this slot
+				uint32_t index;
+				while ((index = m_heads[list]) != NIL)
+				{
+					Unlink(index);
+					Link(index);
+				}
+			}
+
+			uint16_t list = static_cast<uint16_t>(m_now & (SLOTS_PER_LEVEL - 1));
+
+			// The callback may arm and cancel timers, take the nodes one at a time from the list itself. New timers expire after m_now, so they never land here
+			uint32_t index;
+			while ((index = m_heads[list]) != NIL)
+			{
+				Unlink(index);
+
+				T value = std::move(m_nodes[index].value);
+				Free(index);
+
+				onExpire(value);
+			}
+		}
+
+		uint64_t ToTicksFloor(Clock::time_point t) const
+		{
+			if (t <= m_origin)
+				return 0;
+
+			return static_cast<uint64_t>((t - m_origin) / m_resolution);
+		}
+
+		uint64_t ToTicksCeil(Clock::time_point t) const
+		{
+			if (t <= m_origin)
+				return 0;
+
+			Clock::duration elapsed = t - m_origin;
+			return static_cast<uint64_t>((elapsed + m_resolution - Clock::duration(1)) / m_resolution);
+		}
+
+	public:
+		TimerWheel(Clock::duration resolution) : m_origin(Clock::now()), m_resolution(resolution)
+		{
+			for (uint32_t& head : m_heads)
+				head = NIL;
+		}
+
+		//-----------------------------------------------------------------------------------------------------
+		// Arms a timer that expires at deadline (or at the next tick, if deadline has already passed)
+		//-----------------------------------------------------------------------------------------------------
+		TimerHandle Arm(Clock::time_point deadline, T value)
+		{
+			uint64_t expiry = ToTicksCeil(deadline);
+
+			if (expiry <= m_now)
+				expiry = m_now + 1;
+			else if (expiry - m_now > MAX_TICKS)
+				expiry = m_now + MAX_TICKS;
+
+			uint32_t index;
+
+			if (m_freeHead != NIL)
+			{
+				index = m_freeHead;
+				m_freeHead = m_nodes[index].next;
+			}
+			else
+			{
+				index = static_cast<uint32_t>(m_nodes.size());
+				m_nodes.push_back({ T(), 0, NIL, NIL, 0, 0 });
+			}
+
+			Node& node = m_nodes[index];
+			node.value = std::move(value);
+			node.expiry = expiry;
+
+			Link(index);
+			m_armed++;
+
+			return { index, node.generation };
+		}
+
+		//-----------------------------------------------------------------------------------------------------
+		// Returns false if the timer has already expired or has been cancelled
+		//-----------------------------------------------------------------------------------------------------
+		bool Cancel(TimerHandle h)
+		{
+			if (h.index >= m_nodes.size() || m_nodes[h.index].generation != h.generation)
+				return false;
+
+			Unlink(h.index);
+			Free(h.index);
+
+			return true;
+		}
+
+		//-----------------------------------------------------------------------------------------------------
+		// Calls onExpire(T&) for every timer expired by now, in order of expiry (timers of the same tick in no particular order).
+		// Ticks where nothing happens are skipped, so a long sleep costs nothing more than a short one
+		//-----------------------------------------------------------------------------------------------------
+		template<typename F>
+		void Advance(Clock::time_point now, F&& onExpire)
+		{
+			uint64_t target = ToTicksFloor(now);
+
+			while (m_now < target)
+			{
+				uint64_t next = NextEventTick();
+
+				// Nothing in between, the slots we skip are empty
+				if (next > target)
+				{
+					m_now = target;
+					break;
+				}
+
+				m_now = next;
+				ProcessTick(onExpire);
+			}
+		}
+
+		//-----------------------------------------------------------------------------------------------------
+		// Milliseconds from now to the next time Advance() has something to do, capped to maxTimeout (-1 means no cap)
+		//-----------------------------------------------------------------------------------------------------
+		int GetTimeout(Clock::time_point now, int maxTimeout) const
+		{
+			uint64_t next = NextEventTick();
+
+			if (next == NO_TICK)
+				return maxTimeout;
+
+			Clock::time_point at = m_origin + m_resolution * static_cast<Clock::rep>(next);
+
+			if (at <= now)
+				return 0;
+
+			auto untilNext = std::chrono::ceil<std::chrono::milliseconds>(at - now).count();
+
+			if (maxTimeout < 0 || untilNext < maxTimeout)
+				return static_cast<int>(untilNext);
+
+			return maxTimeout;
+		}
+
+		size_t Size() const
+		{
+			return m_armed;
+		}
+
+		bool Empty() const
+		{
+			return m_armed == 0;
+		}
+	};
+
+}
+
+#endif
@@ -0,0 +1,137 @@
+// AESBench
+//
+// Compares the one-shot AES::Encrypt/Decrypt against AES::SessionCipher on fixed-size messages, and checks that
+// each API decrypts what the other one encrypted. Only needs AES.h and OpenSSL:
+//
+//     g++ -std=c++17 -O2 -I../../shared/Encryption main.cpp -lcrypto -o AESBench
+//     AESBench [messageSize=128] [messages=200000]
+
+#include "AES.h"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+using namespace NECRO;
+
+typedef std::chrono::steady_clock Clock;
+
+//-----------------------------------------------------------------------------------------------------
+// Runs f(i) for every message and returns the messages per second, or -1 if f failed
+//-----------------------------------------------------------------------------------------------------
+template<typename F>
+static double MessagesPerSecond(int messages, F&& f)
+{
+	Clock::time_point start = Clock::now();
+
+	for (int i = 0; i < messages; i++)
+	{
+		if (f(i) < 0)
+			return -1;
+	}
+
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	return messages / seconds;
+}
+
+//-----------------------------------------------------------------------------------------------------
+// Same layout as AES::IV::ToByteArray, without AES::IV's constructor (RAND_bytes) in the timed loops
+//-----------------------------------------------------------------------------------------------------
+static void MakeIV(uint64_t counter, std::array<uint8_t, GCM_IV_SIZE>& out)
+{
+	const uint32_t prefix = 0x4E524543;
+	std::memcpy(out.data(), &prefix, sizeof(prefix));
+	std::memcpy(out.data() + sizeof(prefix), &counter, sizeof(counter));
+}
+
+int main(int argc, char** argv)
+{
+	int messageSize = argc > 1 ? std::atoi(argv[1]) : 128;
+	int messages = argc > 2 ? std::atoi(argv[2]) : 200000;
+
+	if (messageSize <= 0 || messages <= 0)
+	{
+		std::cout << "Usage: AESBench [messageSize] [messages]" << std::endl;
+		return 1;
+	}
+
+	std::array<uint8_t, AES_128_KEY_SIZE> key = AES::GenerateSessionKey();
+
+	AES::SessionCipher cipher;
+	if (cipher.SetKey(key.data()) != 0)
+	{
+		std::cout << "Could not key the SessionCipher." << std::endl;
+		return 1;
+	}
+
+	std::vector<uint8_t> plaintext(messageSize);
+	for (int i = 0; i < messageSize; i++)
+		plaintext[i] = static_cast<uint8_t>(i * 31 + 7);
+
+	std::vector<uint8_t> ciphertext(messageSize);
+	std::vector<uint8_t> decrypted(messageSize);
+	std::array<uint8_t, GCM_TAG_SIZE> tag;
+	std::array<uint8_t, GCM_IV_SIZE> iv;
+
+	// Interoperability: each API must decrypt the frames of the other
+	for (uint64_t c = 0; c < 2; c++)
+	{
+		MakeIV(c, iv);
+
+		bool sessionEncrypts = (c == 0);
+		int r = sessionEncrypts ? cipher.Encrypt(plaintext.data(), messageSize, nullptr, 0, iv.data(), ciphertext.data(), tag.data())
+								: AES::Encrypt(plaintext.data(), messageSize, nullptr, 0, key.data(), iv.data(), GCM_IV_SIZE, ciphertext.data(), tag.data());
+
+		int d = sessionEncrypts ? AES::Decrypt(ciphertext.data(), r, nullptr, 0, tag.data(), key.data(), iv.data(), GCM_IV_SIZE, decrypted.data())
+								: cipher.Decrypt(ciphertext.data(), r, nullptr, 0, tag.data(), iv.data(), decrypted.data());
+
+		if (r != messageSize || d != messageSize || decrypted != plaintext)
+		{
+			std::cout << "Mismatch: " << (sessionEncrypts ? "SessionCipher -> AES::Decrypt" : "AES::Encrypt -> SessionCipher") << " failed." << std::endl;
+			return 2;
+		}
+	}
+
+	std::cout << "SessionCipher and AES::Encrypt/Decrypt decrypt each other's output." << std::endl;
+
+	// Encrypt
+	double oneShotEnc = MessagesPerSecond(messages, [&](int i)
+		{
+			MakeIV(i, iv);
+			return AES::Encrypt(plaintext.data(), messageSize, nullptr, 0, key.data(), iv.data(), GCM_IV_SIZE, ciphertext.data(), tag.data());
+		});
+
+	double sessionEnc = MessagesPerSecond(messages, [&](int i)
+		{
+			MakeIV(i, iv);
+			return cipher.Encrypt(plaintext.data(), messageSize, nullptr, 0, iv.data(), ciphertext.data(), tag.data());
+		});
+
+	// Decrypt, always the same frame (the last one encrypted)
+	double oneShotDec = MessagesPerSecond(messages, [&](int)
+		{
+			return AES::Decrypt(ciphertext.data(), messageSize, nullptr, 0, tag.data(), key.data(), iv.data(), GCM_IV_SIZE, decrypted.data());
+		});
+
+	double sessionDec = MessagesPerSecond(messages, [&](int)
+		{
+			return cipher.Decrypt(ciphertext.data(), messageSize, nullptr, 0, tag.data(), iv.data(), decrypted.data());
+		});
+
+	if (oneShotEnc < 0 || sessionEnc < 0 || oneShotDec < 0 || sessionDec < 0 || decrypted != plaintext)
+	{
+		std::cout << "An operation failed during the benchmark." << std::endl;
+		return 2;
+	}
+
+	std::cout << messages << " messages of " << messageSize << " bytes (messages per second):" << std::endl;
+	std::cout << "  Encrypt  one-shot: " << static_cast<uint64_t>(oneShotEnc) << "  SessionCipher: " << static_cast<uint64_t>(sessionEnc)
+			  << "  (x" << sessionEnc / oneShotEnc << ")" << std::endl;
+	std::cout << "  Decrypt  one-shot: " << static_cast<uint64_t>(oneShotDec) << "  SessionCipher: " << static_cast<uint64_t>(sessionDec)
+			  << "  (x" << sessionDec / oneShotDec << ")" << std::endl;
+
+	return 0;
+}